@@ -0,0 +1,609 @@
+/*
+* File name: bench.cpp
+* File abstract: this is a programm to simulate cache coherent,
+*                this file generates synthetic workloads and measures the simulator library on them,
+*                it prints accesses per second, ns per access and peak memory for each workload and cache size,
+*                or prints a workload as a text trace to run with P2
+*
+* Version: 1.0
+* Author: Xiaoming Sun
+* Date: 2014-04-27
+*/
+
+#include "cache_api.h" // reference to the C interface of the library
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <time.h> // time the simulation
+#include <sys/resource.h> // get the peak memory of a run
+#include <sys/wait.h> // wait for the process of a run
+#include <unistd.h> // run each benchmark in its own process
+
+/*
+* enum type for synthetic workloads, in the same order as WorkloadNames
+*	stream is each core reading its own part of memory from start to end
+* 	random is each core reading and writing anywhere, one in four accesses is a write
+*   strided is each core reading its own part of memory with a stride of BENCH_STRIDE bytes
+*   chase is each core following one random cycle through all lines of memory
+*   prodcons is one half of the cores writing lines of a buffer that the other half reads
+*   migratory is a core reading and writing an object, then the next core doing the same
+*   falseshare is each core writing its own word of a few lines shared by all cores
+*/
+enum workload_type{WORKLOAD_STREAM, WORKLOAD_RANDOM, WORKLOAD_STRIDED, WORKLOAD_CHASE,
+                   WORKLOAD_PRODUCER_CONSUMER, WORKLOAD_MIGRATORY, WORKLOAD_FALSE_SHARING, NUMBER_OF_WORKLOADS};
+const char *WorkloadNames[] = {"stream", "random", "strided", "chase", "prodcons", "migratory", "falseshare"};
+
+#define BENCH_LINE 64 // cache line size in bytes
+#define BENCH_WORD 8 // size of each access in bytes
+#define BENCH_STRIDE 4096 // stride of the strided workload in bytes
+#define BENCH_BUFFER (64 << 10) // buffer of each producer and consumer in bytes
+#define BENCH_OBJECTS 1024 // the number of objects of the migratory workload
+#define BENCH_SHARED_LINES 16 // the number of lines of the false sharing workload
+#define BENCH_MAX_SIZES 16 // the most cache sizes of one run
+
+/*
+* struct bench_access, one read or write of a workload
+*	address is the memory address
+* 	chip_id is the chip ID, core_id is the core ID
+*   is_write is 1 for a write
+*/
+struct bench_access
+{
+       unsigned long address;
+       int chip_id;
+       int core_id;
+       bool is_write;
+};
+
+/*
+* struct bench_size, a cache size with number and unit
+*	data is a decimal number for size
+* 	unit is one of simulator_unit_size
+*   text is the size as it is given
+*/
+struct bench_size
+{
+       unsigned long data;
+       int unit;
+       const char *text;
+};
+
+/*
+* struct bench_config, what to run
+*	chips is the number of chips, cores is the number of cores of each chip
+* 	accesses is the number of reads and writes of each workload
+*   footprint is the bytes of memory the workloads use
+*   ways is the number of ways of each cache, 0 means fully associative
+*   seed is the seed of the random numbers
+*/
+struct bench_config
+{
+       int chips;
+       int cores;
+       unsigned long accesses;
+       unsigned long footprint;
+       int ways;
+       unsigned long seed;
+};
+
+/*
+* struct bench_result, what a run measures, passed from its process by a pipe
+*	seconds is the time to simulate all accesses
+* 	peak_rss is the peak memory of the run in KB, cache_rss is the part after the workload is generated
+*   stats is the counters of all chips
+*/
+struct bench_result
+{
+       double seconds;
+       long peak_rss;
+       long cache_rss;
+       simulator_stats stats;
+};
+
+/*
+* declare internal functions
+*/
+unsigned long _nextRandom(unsigned long *state); // get the next number of a xorshift random sequence
+void _generateWorkload(workload_type type, const bench_config *config, bench_access accesses[]); // fill the accesses of a workload
+void _configureSimulator(simulator *sim, const bench_config *config, const bench_size *size); // configure a simulator with L2 of size for each chip
+void _checkSimulator(simulator *sim, int result); // print the error of a call of the simulator and exit, if it failed
+void _printTrace(const bench_config *config, const bench_size *size, const bench_access accesses[]); // print a workload as a text trace
+void _runBenchmark(workload_type type, const bench_config *config, const bench_size *size); // run a workload in a new process and print its row
+void _measureBenchmark(workload_type type, const bench_config *config, const bench_size *size, bench_result *result); // generate and simulate a workload
+bool _parseBenchSize(const char *text, bench_size *size); // parse a size like 32KB
+long _peakRSS(); // the peak memory of this process in KB
+
+/*
+* main function, parse the options, then run each workload with each cache size
+*/
+int main(int argc, char *argv[])
+{
+    bench_config config = {2, 2, 1000000, 64UL << 20, 8, 1};
+    bool isWorkload[NUMBER_OF_WORKLOADS];
+    bench_size sizes[BENCH_MAX_SIZES];
+    int sizeCount = 0;
+    bool isTrace = 0;
+    char defaultSizes[] = "32KB,1MB,32MB,256MB";
+    char *sizeList = defaultSizes;
+
+    for(int i=0; i<NUMBER_OF_WORKLOADS; i++)
+    {
+        isWorkload[i] = 1;
+    }
+
+    // -w name,... workloads, -n N accesses, -f size footprint, -c N chips, -k N cores of each chip,
+    // -s size,... L2 size of each chip, L3 is as big as all L2, -a N ways, 0 for fully associative,
+    // -r N random seed, -g print the first workload with the first size as a text trace
+    for(int i=1; i<argc; i++)
+    {
+        bool hasValue = i+1 < argc;
+
+        if(strcmp(argv[i], "-w") == 0 && hasValue)
+        {
+            char *names = argv[++i];
+
+            for(int j=0; j<NUMBER_OF_WORKLOADS; j++)
+            {
+                isWorkload[j] = 0;
+            }
+
+            for(char *name = strtok(names, ","); name != NULL; name = strtok(NULL, ","))
+            {
+                int type = 0;
+
+                while(type < NUMBER_OF_WORKLOADS && strcmp(WorkloadNames[type], name) != 0) {type++;};
+
+                if(type == NUMBER_OF_WORKLOADS)
+                {
+                    printf("main::Not found expected workload %s, invalid input!\n", name);
+                    exit(1);
+                }
+
+                isWorkload[type] = 1;
+            }
+        }
+        else if(strcmp(argv[i], "-n") == 0 && hasValue)
+        {
+            config.accesses = strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "-f") == 0 && hasValue)
+        {
+            bench_size footprint;
+
+            if(!_parseBenchSize(argv[++i], &footprint))
+            {
+                printf("main::Not found expected footprint size %s, invalid input!\n", argv[i]);
+                exit(1);
+            }
+
+            config.footprint = footprint.data << (10 * footprint.unit);
+        }
+        else if(strcmp(argv[i], "-c") == 0 && hasValue)
+        {
+            config.chips = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "-k") == 0 && hasValue)
+        {
+            config.cores = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "-s") == 0 && hasValue)
+        {
+            sizeList = argv[++i];
+        }
+        else if(strcmp(argv[i], "-a") == 0 && hasValue)
+        {
+            config.ways = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "-r") == 0 && hasValue)
+        {
+            config.seed = strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "-g") == 0)
+        {
+            isTrace = 1;
+        }
+        else
+        {
+            printf("Usage: %s [-w %s", argv[0], WorkloadNames[0]);
+
+            for(int j=1; j<NUMBER_OF_WORKLOADS; j++)
+            {
+                printf(",%s", WorkloadNames[j]);
+            }
+
+            printf("] [-n accesses] [-f footprint] [-c chips] [-k cores] [-s L2size,...] [-a ways] [-r seed] [-g]\n");
+            exit(1);
+        }
+    }
+
+    for(char *text = strtok(sizeList, ","); text != NULL; text = strtok(NULL, ","))
+    {
+        if(sizeCount == BENCH_MAX_SIZES || !_parseBenchSize(text, &sizes[sizeCount]) || sizes[sizeCount].unit == SIM_B)
+        {
+            printf("main::Not found expected cache size %s, invalid input!\n", text);
+            exit(1);
+        }
+
+        sizeCount++;
+    }
+
+    if(config.chips < 1 || config.cores < 1 || config.ways < 0 || config.footprint < BENCH_BUFFER || sizeCount == 0)
+    {
+        printf("main::Chips, cores, ways, footprint or cache sizes are out of range, invalid input!\n");
+        exit(1);
+    }
+
+    if(isTrace)
+    {
+        int type = 0;
+
+        while(!isWorkload[type]) {type++;};
+
+        bench_access *accesses = new bench_access[config.accesses];
+
+        _generateWorkload((workload_type)type, &config, accesses);
+        _printTrace(&config, &sizes[0], accesses);
+
+        delete[] accesses;
+        return EXIT_SUCCESS;
+    }
+
+    printf("workload,l2_size,accesses,seconds,accesses_per_s,ns_per_access,peak_rss_kb,cache_rss_kb,l2_miss_ratio\n");
+    fflush(stdout);
+
+    for(int type=0; type<NUMBER_OF_WORKLOADS; type++)
+    {
+        for(int i=0; isWorkload[type] && i<sizeCount; i++)
+        {
+            _runBenchmark((workload_type)type, &config, &sizes[i]);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+unsigned long _nextRandom(unsigned long *state)
+{
+    unsigned long x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    *state = x;
+
+    return x;
+}
+
+void _generateWorkload(workload_type type, const bench_config *config, bench_access accesses[])
+{
+    int threads = config->chips * config->cores;
+    unsigned long region = config->footprint / threads / BENCH_LINE * BENCH_LINE; // the part of memory of each core
+    unsigned long lines = config->footprint / BENCH_LINE;
+    unsigned long state = config->seed * 0x9E3779B97F4A7C15UL + 1;
+    unsigned long *next = NULL;
+    unsigned long *position = new unsigned long[threads](); // the progress of each core
+    unsigned long *owner = new unsigned long[BENCH_OBJECTS](); // the number of moves of each migratory object
+
+    if(type == WORKLOAD_CHASE)
+    {
+        // one cycle through all lines, by Sattolo's algorithm, each core starts at its own line
+        next = new unsigned long[lines];
+
+        for(unsigned long i=0; i<lines; i++)
+        {
+            next[i] = i;
+        }
+
+        for(unsigned long i=lines-1; i>0; i--)
+        {
+            unsigned long j = _nextRandom(&state) % i;
+            unsigned long temp = next[i];
+
+            next[i] = next[j];
+            next[j] = temp;
+        }
+
+        for(int t=0; t<threads; t++)
+        {
+            position[t] = lines / threads * t;
+        }
+    }
+
+    for(unsigned long i=0; i<config->accesses; i++)
+    {
+        bench_access *access = &accesses[i];
+        int thread = i % threads;
+        unsigned long step = i / threads;
+
+        access->is_write = 0;
+
+        switch(type)
+        {
+            case WORKLOAD_STREAM:
+                access->address = region * thread + step * BENCH_WORD % region;
+                break;
+
+            case WORKLOAD_RANDOM:
+                access->address = _nextRandom(&state) % (config->footprint / BENCH_WORD) * BENCH_WORD;
+                access->is_write = _nextRandom(&state) % 4 == 0;
+                break;
+
+            case WORKLOAD_STRIDED:
+                // move by one line after each pass, so every line is touched
+                access->address = region * thread + (step * BENCH_STRIDE + step * BENCH_STRIDE / region * BENCH_LINE) % region;
+                break;
+
+            case WORKLOAD_CHASE:
+                position[thread] = next[position[thread]];
+                access->address = position[thread] * BENCH_LINE;
+                break;
+
+            case WORKLOAD_PRODUCER_CONSUMER:
+            {
+                // core t of the first half writes a line, then core t of the second half reads it
+                int pairs = threads > 1 ? threads / 2 : 1;
+                int pair = step % pairs;
+                unsigned long line = step / pairs / 2 % (BENCH_BUFFER / BENCH_LINE);
+
+                thread = (step / pairs % 2 == 0 || threads == 1) ? pair : pair + pairs;
+                access->address = (unsigned long)BENCH_BUFFER * pair + line * BENCH_LINE;
+                access->is_write = step / pairs % 2 == 0;
+                break;
+            }
+
+            case WORKLOAD_MIGRATORY:
+            {
+                // a read then a write of one object, then it moves to the next core
+                unsigned long object = (i % 2 == 0) ? _nextRandom(&state) % BENCH_OBJECTS : accesses[i-1].address / BENCH_LINE;
+
+                thread = owner[object] % threads;
+                access->address = object * BENCH_LINE;
+                access->is_write = i % 2 == 1;
+
+                if(access->is_write) owner[object]++;
+                break;
+            }
+
+            default:
+                access->address = _nextRandom(&state) % BENCH_SHARED_LINES * BENCH_LINE + thread * BENCH_WORD % BENCH_LINE;
+                access->is_write = 1;
+                break;
+        }
+
+        access->chip_id = thread / config->cores;
+        access->core_id = thread % config->cores;
+    }
+
+    delete[] next;
+    delete[] position;
+    delete[] owner;
+}
+
+void _configureSimulator(simulator *sim, const bench_config *config, const bench_size *size)
+{
+    // memory in MB, big enough for the footprint
+    _checkSimulator(sim, simulatorMemorySize(sim, (config->footprint + (1 << 20) - 1) >> 20, SIM_MB));
+    _checkSimulator(sim, simulatorNumOfChips(sim, config->chips));
+    _checkSimulator(sim, simulatorNumOfCores(sim, -1, config->cores));
+    _checkSimulator(sim, simulatorCacheLineSize(sim, BENCH_LINE, SIM_B));
+
+    for(int i=0; i<config->chips; i++)
+    {
+        _checkSimulator(sim, simulatorCacheSize(sim, i, size->data, size->unit));
+    }
+
+    if(config->chips > 1)
+    {
+        _checkSimulator(sim, simulatorCacheSize(sim, -1, size->data * config->chips, size->unit));
+    }
+
+    for(int i=0; i<config->chips; i++)
+    {
+        _checkSimulator(sim, simulatorCacheAccessSpeed(sim, i, 2, SIM_NS));
+    }
+
+    if(config->chips > 1)
+    {
+        _checkSimulator(sim, simulatorCacheAccessSpeed(sim, -1, 7, SIM_NS));
+    }
+
+    _checkSimulator(sim, simulatorReplacementSpeed(sim, 1, SIM_NS));
+    _checkSimulator(sim, simulatorBroadcastSpeed(sim, 3, SIM_NS));
+    _checkSimulator(sim, simulatorMemoryAccessSpeed(sim, 20, SIM_NS));
+
+    for(int i=0; config->ways > 0 && i<config->chips; i++)
+    {
+        _checkSimulator(sim, simulatorCacheAssociativity(sim, i, config->ways));
+    }
+
+    if(config->ways > 0 && config->chips > 1)
+    {
+        _checkSimulator(sim, simulatorCacheAssociativity(sim, -1, config->ways));
+    }
+}
+
+void _checkSimulator(simulator *sim, int result)
+{
+    if(result != 0)
+    {
+        printf("_configureSimulator::%s\n", simulatorGetError(sim));
+        exit(1);
+    }
+}
+
+void _printTrace(const bench_config *config, const bench_size *size, const bench_access accesses[])
+{
+    const char *units[] = {"B", "KB", "MB", "GB"};
+    bool isMultiChip = config->chips > 1;
+
+    printf("memorySize(%luMB)\n", (config->footprint + (1 << 20) - 1) >> 20);
+
+    if(isMultiChip)
+    {
+        printf("numOfChips(%d)\n", config->chips);
+    }
+
+    printf("numOfCores(%d)\n", config->cores);
+    printf("cacheLineSize(%dB)\n", BENCH_LINE);
+
+    for(int i=0; isMultiChip && i<config->chips; i++)
+    {
+        printf("cacheSize(%d,%s)\n", i, size->text);
+    }
+
+    printf("cacheSize(%lu%s)\n", size->data * config->chips, units[size->unit]);
+
+    for(int i=0; isMultiChip && i<config->chips; i++)
+    {
+        printf("cacheAccessSpeed(%d,2ns)\n", i);
+    }
+
+    printf("cacheAccessSpeed(%dns)\n", isMultiChip ? 7 : 2);
+    printf("replacementSpeed(1ns)\nbroadcastSpeed(3ns)\nmemoryAccessSpeed(20ns)\n");
+
+    for(int i=0; config->ways > 0 && isMultiChip && i<config->chips; i++)
+    {
+        printf("cacheAssociativity(%d,%d)\n", i, config->ways);
+    }
+
+    if(config->ways > 0)
+    {
+        printf("cacheAssociativity(%d)\n", config->ways);
+    }
+
+    for(unsigned long i=0; i<config->accesses; i++)
+    {
+        const bench_access *access = &accesses[i];
+
+        if(isMultiChip)
+        {
+            printf("%s(%d,%d,0x%lx,%dB)\n", access->is_write ? "write" : "read", access->chip_id, access->core_id, access->address, BENCH_WORD);
+        }
+        else
+        {
+            printf("%s(%d,0x%lx,%dB)\n", access->is_write ? "write" : "read", access->core_id, access->address, BENCH_WORD);
+        }
+    }
+}
+
+void _runBenchmark(workload_type type, const bench_config *config, const bench_size *size)
+{
+    bench_result result;
+    int fds[2];
+
+    // a process for each run, so the peak memory is its own
+    if(pipe(fds) != 0)
+    {
+        printf("_runBenchmark::Can not create a pipe!\n");
+        exit(1);
+    }
+
+    fflush(stdout);
+
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        close(fds[0]);
+        _measureBenchmark(type, config, size, &result);
+
+        if(write(fds[1], &result, sizeof(result)) != sizeof(result)) _exit(1);
+
+        _exit(0);
+    }
+
+    close(fds[1]);
+
+    int status = 0;
+    bool isRead = pid > 0 && read(fds[0], &result, sizeof(result)) == sizeof(result);
+
+    close(fds[0]);
+
+    if(pid > 0) waitpid(pid, &status, 0);
+
+    if(!isRead || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        printf("_runBenchmark::Failed to run %s with %s!\n", WorkloadNames[type], size->text);
+        exit(1);
+    }
+
+    unsigned long hits = result.stats.counts[0];
+    unsigned long misses = result.stats.counts[1];
+
+    printf("%s,%s,%lu,%.3f,%.0f,%.1f,%ld,%ld,%.6f\n", WorkloadNames[type], size->text, config->accesses, result.seconds,
+           config->accesses / result.seconds, result.seconds * 1e9 / config->accesses, result.peak_rss, result.cache_rss,
+           hits + misses > 0 ? (double)misses / (hits + misses) : 0.0);
+}
+
+void _measureBenchmark(workload_type type, const bench_config *config, const bench_size *size, bench_result *result)
+{
+    bench_access *accesses = new bench_access[config->accesses];
+    struct timespec start, end;
+
+    _generateWorkload(type, config, accesses);
+
+    long baseRSS = _peakRSS();
+    simulator *sim = simulatorCreate();
+
+    simulatorSetOutput(sim, NULL, 1);
+    _configureSimulator(sim, config, size);
+
+    // only the reads and writes are timed, the caches are built before
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for(unsigned long i=0; i<config->accesses; i++)
+    {
+        const bench_access *access = &accesses[i];
+
+        if(access->is_write)
+        {
+            simulatorWrite(sim, access->chip_id, access->core_id, access->address, BENCH_WORD);
+        }
+        else
+        {
+            simulatorRead(sim, access->chip_id, access->core_id, access->address, BENCH_WORD);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    result->peak_rss = _peakRSS();
+    result->cache_rss = result->peak_rss - baseRSS;
+    simulatorGetStats(sim, -1, -1, &result->stats);
+
+    simulatorDestroy(sim);
+    delete[] accesses;
+}
+
+bool _parseBenchSize(const char *text, bench_size *size)
+{
+    const char *units[] = {"B", "KB", "MB", "GB"};
+    char *end;
+
+    size->data = strtoul(text, &end, 10);
+    size->text = text;
+
+    for(int i=0; i<4; i++)
+    {
+        if(end != text && size->data > 0 && strcmp(end, units[i]) == 0)
+        {
+            size->unit = i;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+long _peakRSS()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
@@ -10,70 +10,168 @@
 */
 
 #include "cache.h" // reference to cache head files
+#include "cache_api.h" // reference to the C interface of the library
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // SIMD tag compare
+#endif
+
+#include <fcntl.h> // open a trace file
+#include <sys/mman.h> // map a trace file into memory
+#include <sys/stat.h> // get the size of a trace file
+#include <unistd.h> // close a trace file
+#include <thread> // run trace stages on their own threads
+#include <atomic> // ring buffers between the pipeline stages
+#include <mutex> // pass decompressed chunks between threads
+#include <condition_variable>
+
+#ifdef CACHE_PROFILE
+#include <chrono> // ticks of the profile where there is no TSC
+#endif
+
+#ifdef USE_ZLIB
+#include <zlib.h> // read .gz traces
+#endif
+
+#ifdef USE_ZSTD
+#include <zstd.h> // read .zst traces
+#endif
 
 /*
-* memory_size is the size of memory
-* cache_line_size is the size of cache line
-* cache_size_l3 is the size of l3
+* compressed trace formats, found by the magic number at the start of a file
 */
-obj_size memory_size, cache_line_size, cache_size_l3;
+enum trace_compression : int{TRACE_GZIP, TRACE_ZSTD};
 
 /*
-* replacement_speed is the speed of cache replacement
-* broadcast_speed is the speed of broadcast
-* memory_access_speed is the access speed of memory
-* cache_access_speed_l3 is the access speed of cache L3
+* struct spsc_ring, a ring buffer of N items between one producer thread and one consumer thread
+*	items is the memory of the ring
+* 	head is the next item to take, only moved by the consumer after the item is used
+*   tail is the next item to put, only moved by the producer
 */
-obj_time replacement_speed, broadcast_speed, memory_access_speed, cache_access_speed_l3;
+template <typename T, int N>
+struct spsc_ring
+{
+       T items[N];
+       atomic<unsigned long> head;
+       atomic<unsigned long> tail;
+       
+       spsc_ring() : head(0), tail(0) {}
+};
 
 /*
-* memory_pages is the total pages of memory, divided by cache line size
-* total_block_l3 is the total blocks in cache L3, divided by cache line size
+* the pipeline runs a trace file in three stages on three threads,
+* parsing lines into commands, simulating commands, and formatting output
 */
-unsigned long memory_pages, total_block_l3;
+#define LINE_RING_SIZE 1024
+#define OUTPUT_RING_SIZE (1 << 14)
 
 /*
-* number_of_chips is the number of chips, default is 1
-* array_usage_l3 is an array to track the usage of cache L3
+* enum type for one piece of output
 */
-int number_of_chips=1, *array_usage_l3;
+enum output_kind : int{OUTPUT_STRING, OUTPUT_TEXT, OUTPUT_CHAR, OUTPUT_NUMBER, OUTPUT_HEX, OUTPUT_END};
 
 /*
-* commands[9] is an array to record commands for ordering and usage
-* funcNames[9] is an array to record function names for ordering and usage
+* struct output_token, one piece of output passed from the simulation stage to the formatting stage
+*	kind is the output_kind
+* 	length is the length of a text
+*   str is a string or text, it must live until the formatting stage is drained
+*   value is a number or a character
 */
-bool commands[9];
-string funcNames[9] = {"memorySize", "numOfChips",
-                       "numOfCores", "cacheLineSize",
-                       "cacheSize", "cacheAccessSpeed",
-                       "replacementSpeed", "broadcastSpeed", "memoryAccessSpeed"};
+struct output_token
+{
+       output_kind kind;
+       size_t length;
+       union
+       {
+           const char *str;
+           unsigned long value;
+       };
+};
+
 /*
-* l2ID is to record all block IDs used in cache L2
-* l2State is to record all all state used in cache L2
-* l3ID is to record all block IDs used in cache L3
-* l3State is to record all all state used in cache L3
+* struct trace_stream, the state to run a trace which comes in chunks
+*	kind is 0 before the first bytes are seen, then 1 for text and 2 for binary
+* 	has_header is set after the binary header is checked
+*   carry is a line or record split between two chunks
 */
-string l2ID = "";
-string l2State = "";
-string l3ID = "";
-string l3State = "";
-        
+struct trace_stream
+{
+       int kind;
+       bool has_header;
+       string carry;
+};
+
+/*
+* struct line_result
+*	block is to record all block IDs used in one read or write
+* 	state is to record all state used in one read or write
+*   length is how many lines are recorded, capacity is how many lines fit
+*/
+struct line_result
+{
+    int *block;
+    char *state;
+    int length;
+    int capacity;
+};
+
+/*
+* every block in a TLB is one packed 64-bit line, the TLB index is the block ID
+*	bits 0-43 are the page ID of using page in memory
+* 	bits 44-59 are the owner of block, core ID in L2, chip ID * 10 + core ID in L3
+*   bits 60-61 are the status of block, four values(I,M,E,S), I is 0
+*   bit 63 is set when this line is valid, a line of 0 is an empty invalid block
+*/
+const unsigned long long LINE_PAGE_MASK = (1ULL << 44) - 1;
+const int LINE_OWNER_SHIFT = 44;
+const unsigned long long LINE_OWNER_MASK = 0xFFFFULL << LINE_OWNER_SHIFT;
+const int LINE_STATE_SHIFT = 60;
+const unsigned long long LINE_STATE_MASK = 3ULL << LINE_STATE_SHIFT;
+const unsigned long long LINE_VALID = 1ULL << 63;
+const char LineStateNames[] = {'I', 'M', 'E', 'S'}; // name array for status of block
+
+/*
+* struct page_index
+*	keys is the memory page kept in each bucket, NULL when the cache is set
+*   associative, then a lookup scans the ways of one set instead
+* 	values is the TLB index of that page, -1 means the bucket is empty
+*   mask is the number of buckets minus 1, the number of buckets is a power of 2
+*/
+struct page_index
+{
+    unsigned long *keys;
+    int *values;
+    unsigned long mask;
+};
+
 /*
-* struct entry
-*	valid is int to record this entry is valid or not, initial value is 0, means invalid
-* 	block_id is the ID of using block in cache
-*   memory_page is the page ID of using page in memory
-*   state is the status of block, four values(M,E,S,I)
+* struct lru_list
+*	prev is the TLB index accessed just before each entry in its set, -1 for none
+* 	next is the TLB index accessed just after each entry in its set, -1 for none
+*   head is the least recently used TLB index of each set
+*   tail is the most recently used TLB index of each set
 */
-struct entry
+struct lru_list
 {
-    int valid;
-    int block_id;
-    unsigned long memory_page;
-    char state;     
+    int *prev;
+    int *next;
+    int *head;
+    int *tail;
 };
 
-entry *tlb_l3; // TLB for cache L3
+/*
+* struct block_bitmap
+*	words is one bit for each block, 1 means the block is still empty
+* 	free_count is the number of empty blocks left in each set
+*   next_word is the first word of each set that may still have an empty block,
+*   blocks are never given back, so the words before it are all used
+*/
+struct block_bitmap
+{
+    unsigned long long *words;
+    int *free_count;
+    int *next_word;
+};
 
 /*
 * struct chip
@@ -81,8 +179,14 @@ entry *tlb_l3; // TLB for cache L3
 * 	cache_size_l2 is the size of cache L2
 *   cache_access_speed_l2 is the access speed of cache L2
 *   total_block_l2 is the total blocks of cache L2
-*   array_usage_l2 is an array to track the usage of cache L2
+*   number_of_ways_l2 is the number of blocks in each set of cache L2
+*   number_of_sets_l2 is the number of sets in cache L2, 1 means fully associative
 *   tlb_l2 is TLB for cache L2
+*   index_l2 is the page to TLB index lookup for cache L2
+*   lru_l2 is the access order of cache L2
+*   bitmap_l2 is the empty blocks of cache L2
+*   memo_page is the last page each core touched in cache L2
+*   memo_block is the TLB index of memo_page for each core, -1 means nothing to remember
 */
 struct chip
 {
@@ -90,1688 +194,5960 @@ struct chip
     obj_size cache_size_l2;
     obj_time cache_access_speed_l2;
     int total_block_l2;
-    int *array_usage_l2;
-    entry *tlb_l2;            
+    int number_of_ways_l2;
+    int number_of_sets_l2;
+    unsigned long long *tlb_l2;
+    page_index index_l2;
+    lru_list lru_l2;
+    block_bitmap bitmap_l2;
+    unsigned long *memo_page;
+    int *memo_block;
 };
 
-chip *array_chips; // an array to record all chips
+/*
+* struct sweep_access, one read or write of a trace kept in memory for a sweep, in 16 bytes
+*	address is the memory address
+* 	size is the number part of the size
+*   chip_id is the chip ID, -1 means no chip ID
+*   core_id is the core ID
+*   flags is 1 for a write, plus the unit of the size shifted left by 1
+*/
+struct sweep_access
+{
+       uint64_t address;
+       uint32_t size;
+       int16_t chip_id;
+       uint8_t core_id;
+       uint8_t flags;
+};
 
 /*
-* struct opt_time
-*	opt is the operation, like miss, hit, write, read
-* 	time is the elapse time of each operation
-*   count is the number of each operation
+* struct sweep_trace, a trace loaded once and run by every configuration of a sweep
+*	config is the commands which are not a read or write
+* 	config_at is the number of accesses before each of config
+*   accesses is the reads and writes
+*   config_length and access_length are the numbers of entries in use,
+*   config_capacity and access_capacity are the numbers of entries that fit
 */
-struct opt_time
+struct sweep_trace
 {
-       string opt;
-       obj_time time;
-       int count;
+       command *config;
+       unsigned long *config_at;
+       int config_length;
+       int config_capacity;
+       sweep_access *accesses;
+       unsigned long access_length;
+       unsigned long access_capacity;
 };
 
-opt_time result_time[100]; // an array to record time results
-int result_index=0; // an index to tell how many time results it has
+/*
+* struct stack_distance, the LRU stack distance of each access in a stream of lines, found in one pass,
+* an access hits in a fully associative LRU cache of N blocks if fewer than N other lines came since the last access to its line
+*	last is the time of the last access to each line
+* 	lines is the number of lines in last, last grows when it is half full
+*   marks is a Fenwick tree over times, with 1 at the time of the last access to each line
+*   line_at is the line of the access at each time
+*   now is the next time, capacity is the number of times in marks, the times are packed when it is full
+*   histogram is the number of accesses at each distance, histogram_length is the number of distances it holds
+*   accesses is the number of accesses, cold is the number of first accesses to a line
+*/
+struct stack_distance
+{
+       page_index last;
+       unsigned long lines;
+       long *marks;
+       unsigned long *line_at;
+       unsigned long now;
+       unsigned long capacity;
+       unsigned long *histogram;
+       unsigned long histogram_length;
+       unsigned long accesses;
+       unsigned long cold;
+};
 
 /*
-* declare internal functions
+* the sharded engine splits the sets of every cache by the remainder of the set index divided by
+* the number of shards, a line always maps to sets of the same remainder, so the lines of different
+* shards never meet in any cache, and each shard is simulated on its own thread
 */
-void _checkValidInput(string strLine); // check if input is valid
-string _getFunctionName(const string strLine); // get function name from input string
-obj_size _getSize(const string strLine, bool isRW); // get size from input string, isRW is 1, means it is read or write
-obj_time _getTime(const string strLine); // get time from input string
-int _getNumber(const string strLine, bool isRW); // get number from input string
-int _getChipID(const string strLine); // get chip ID from input string
-string _getAddress(const string strLine); // get address from input string
-unsigned long _caculateTotalBlocks(obj_size size); // caculate total blocks
-unsigned long _caculateNeedBlocks(unsigned long address, obj_size size); // culate need blocks in cache
-int _checkCacheL2(int chipID, unsigned long loadingPage, bool isAddTime); // check whether it is existing in cache L2
-int _checkCacheL3(int chipID, unsigned long loadingPage, bool isAddTime); // check whether it is existing in cache L3
-void _addResultTime(string opt, obj_time time); // add operation and time into result
-int _findAvailableBlockInCacheL2(int chipID); // find empty block in cache L2
-int _findAvailableBlockInCacheL3(); // find empty block in cache L3
-entry _takeTheFirstOutByLRU(int chipID); // take one out according to LRU from cache L2
-entry _takeTheFirstOutL3ByLRU(); // take one out according to LRU from cache L3
-void _swapTLBByLRU(int chipID, int target, int source); // swap the latest access to the last one in L2 TLB by LRU
-void _swapTLBL3ByLRU(int target, int source); // swap the latest access to the last one in L3 TLB by LRU
-int _getTLBL2UsedBlocks(int chipID); // get how many TLB entries in L2
-int _getTLBL3UsedBlocks(); // get how many TLB entries in L3
-void _readFromCacheL2(int chipID, int coreID, int tblIndex); // read data from cache L2
-void _readFromCacheL3(int chipID, int coreID, int tblIndex); // read data from cache L3
-void _loadMemToCacheL2(int chipID, int coreID, int loadingPage); // load data from memory to L2
-void _writeToCacheL2(int chipID, int coreID, int loadingPage); // write data into cache L2
-void _writeToCacheL3(int chipID, int coreID, int loadingPage, bool isRead); // write data into cache L3
-void _rewriteToCacheL2(int chipID, int coreID, int tlbIndex); // rewrite data into cache L2
-void _rewriteToCacheL3(int chipID, int coreID, int tlbIndex, int loadingPage); // rewrite data into cache L3
-void _printResult(int chipID, int pages[], int pageSize); // print out result
-void _checkCommandsOrder(int index); // check commands are in correct order
-void _checkCommandsReady(); // check commands are enough
-void _checkValidIDs(int chipID, int coreID); // check chipID and coreID is valid
-string _num2str(int number); // convert number to string
+#define SHARD_BATCH_LINES 256
+#define SHARD_RING_SIZE 64
 
 /*
-* main function, this is the program entry to invoke all other functions
+* struct shard_line, one line of a read or write for a shard
+*	page is the memory page divided by the number of shards, the page in the caches of the shard
+* 	chip_id is the chip ID, core_id is the core ID
+*   is_write is 1 for a write
 */
-int main(int argc, char *argv[])
+struct shard_line
 {
-    string strLine;
-    
-    for(int i=0; i<9; i++)
-    {
-        commands[i] = 0;
-    }
-    
-    while(getline(cin, strLine))
-    {
-        if(strLine[0] == '#') continue;
-        
-        cout << strLine << endl;
-        
-        // check if input is valid
-        _checkValidInput(strLine);
-        
-        // get the function name from the input
-        string name = _getFunctionName(strLine);
-        
-        // call memorySize function
-        if(name == "memorySize")
-        {
-                commands[0] = 1;
-                memorySize(_getSize(strLine, 0));
-                continue;
-        }// call numOfChips function, optional, if not input, means 1 chip 
-        else if(name == "numOfChips")
-        {
-                if(commands[0])
-                {
-                   if(!commands[2])
-                   {
-                       commands[1] = 1;
-                   }
-                   else
-                   {
-                       cout << "Input error, this must be the second command!" << endl;
-                       exit(1);
-                   }
-                }
-                else
-                {
-                   cout << "Not input memory size, it must be the first command!" << endl;
-                   exit(1); 
-                }
-                
-                numOfChips(_getNumber(strLine, 0));
-                continue;
-        }// call numOfCores function, if not input Chip ID, means the same number for all chips 
-        else if(name == "numOfCores")
-        {       
-                if(commands[1])
-                {
-                    commands[2] = 1;
-                }
-                else if(commands[0])
-                {
-                    commands[2] = 1; 
-                }
-                else
-                {
-                   cout << "Not input memory size, it must be the first command!" << endl;
-                   exit(1); 
-                }
-                
-                numOfCores(_getChipID(strLine), _getNumber(strLine, 0));
-                continue;
-        }// call cacheLineSize function 
-        else if(name == "cacheLineSize")
-        {
-                _checkCommandsOrder(3);
-                
-                cacheLineSize(_getSize(strLine, 0));
-                continue;
-        }// call cacheSize function
-        else if(name == "cacheSize")
-        {
-                _checkCommandsOrder(4);
-             
-                cacheSize(_getChipID(strLine), _getSize(strLine, 0));
-                continue;
-        }// call cacheAccessSpeed function
-        else if(name == "cacheAccessSpeed")
-        {
-                _checkCommandsOrder(5);
-                
-                cacheAccessSpeed(_getChipID(strLine), _getTime(strLine));
-                continue;
-        }// call replacementSpeed function
-        else if(name == "replacementSpeed")
-        {
-                _checkCommandsOrder(6);
-                replacementSpeed(_getTime(strLine));
-                continue;
-        }// call broadcastSpeed function
-        else if(name == "broadcastSpeed")
-        {
-                _checkCommandsOrder(7);
-                broadcastSpeed(_getTime(strLine));
-                continue;
-        }// call memoryAccessSpeed function
-        else if(name == "memoryAccessSpeed")
-        {
-                _checkCommandsOrder(8);
-                memoryAccessSpeed(_getTime(strLine));
-                continue;
-        }// call write function
-        else if(name == "read")
-        {
-                _checkCommandsReady();
-                read(_getChipID(strLine), _getNumber(strLine, 1), _getAddress(strLine), _getSize(strLine, 1));
-                continue;
-        }// call write function
-        else if(name == "write")
-        {
-                _checkCommandsReady();
-                write(_getChipID(strLine), _getNumber(strLine, 1), _getAddress(strLine), _getSize(strLine, 1));
-                continue;
-        }// not match with any function name
-        else
-        {
-            cout << "Not found expected function, skip it!" << endl;
-        }
-    }
-    
-    return EXIT_SUCCESS;
-}
+       unsigned long page;
+       int chip_id;
+       int core_id;
+       bool is_write;
+};
 
-void memorySize(obj_size size)
+/*
+* struct shard_batch, lines passed to a shard together
+*	lines is the lines in the order of the trace, length is the number of them
+* 	done is 1 when there are no more lines
+*/
+struct shard_batch
 {
-     memory_size = size;
-     //cout << "Memory Size=" << memory_size.data << UnitSizeNames[memory_size.unit] << endl;
-}
+       shard_line lines[SHARD_BATCH_LINES];
+       int length;
+       bool done;
+};
+
+/*
+* the staged engine simulates the L2 of each chip on its own thread, and passes the lines that need L3
+* to one L3 stage, which resolves them in the order of the trace by their sequence numbers,
+* the fills and invalidations it decides go back to the chips, a chip only waits for them
+* before a line of a set that an earlier write or its own read miss may have changed
+*/
+#define COHERENCE_RING_SIZE 4096
+
+/*
+* enum type for what a line needs from L3, or what L3 does to L2 of a chip
+*/
+enum coherence_kind{COHERENCE_NONE, COHERENCE_READ_MISS, COHERENCE_WRITE_HIT, COHERENCE_WRITE_MISS,
+                    COHERENCE_FILL, COHERENCE_INVALIDATE};
 
-void numOfChips(int number)
+/*
+* struct coherence_line, one line of a read or write for a chip
+*	sequence is the number of lines before it in the trace
+* 	page is the memory page
+*   wait is 1 + the sequence number of the last write before it to a page in the same set of L2, 0 for none
+*   core_id is the core ID, is_write is 1 for a write, done is 1 when there are no more lines
+*/
+struct coherence_line
 {
-     number_of_chips = number;
-     
-     // initialize array_chips as expected number
-     array_chips = new chip[number_of_chips];
-     
-     //cout << "Total Chips=" << number_of_chips << endl;
-}
+       unsigned long sequence;
+       unsigned long page;
+       unsigned long wait;
+       int core_id;
+       bool is_write;
+       bool done;
+};
 
-void numOfCores(int chipID, int number)
+/*
+* struct coherence_event, what one line of a chip needs from L3, or what L3 does to L2 of a chip
+*	page is the memory page
+* 	core_id is the core ID
+*   kind is the kind of event
+*/
+struct coherence_event
 {
-     // if only one chip, initialize array_chips as 1
-     if(number_of_chips == 1) 
-     {
-         array_chips = new chip[1];               
-     }
+       unsigned long page;
+       int core_id;
+       coherence_kind kind;
+};
 
-     // if chipID=-1, means no chipID from input, then all chips have the same number of cores
-     // if chipID!=-1, set specified core number for that chip 
-     if(chipID == -1) 
-     {
-         for(int i=0; i<number_of_chips; i++) 
-         {
-             array_chips[i].number_of_core = number;
-         }
-     } 
-     else 
-     {
-         array_chips[chipID].number_of_core = number;  
-     }
-     
-     // print chip id and core number
-     //for(int i=0; i<number_of_chips; i++) 
-//     {
-//         cout << "Chip " << i << ": " << array_chips[i].number_of_core << " cores" << endl;
-//     }
-}
+/*
+* the profile of the hot paths is only built with CACHE_PROFILE, "make PROFILE=1",
+* PROFILE_SCOPE(phase) times the rest of a block as one call of phase, without the blocks timed inside it,
+* each thread keeps its own counters, the total of each phase is printed to standard error at the end
+*/
+#ifdef CACHE_PROFILE
+#define PROFILE_SCOPE(phase) profile_scope profileScope(phase)
+#else
+#define PROFILE_SCOPE(phase)
+#endif
+
+/*
+* enum type for the phases of the profile, in the same order as ProfilePhaseNames,
+* a phase does not include the phases it calls, they are counted in their own phases
+*/
+enum profile_phase{PROFILE_ACCESS, PROFILE_PARSE, PROFILE_GET, PROFILE_VALIDATE, PROFILE_CHECK_L2, PROFILE_CHECK_L3,
+                   PROFILE_LRU, PROFILE_WRITE_L2, PROFILE_WRITE_L3, PROFILE_LOAD_L2, PROFILE_INVALIDATE, PROFILE_PRINT,
+                   NUMBER_OF_PROFILE_PHASES};
 
-void cacheLineSize(obj_size size)
+/*
+* struct profile_counters, the profile of one thread
+*	calls is the number of calls of each phase
+* 	ticks is the time of each phase, in TSC cycles on x86, in ns elsewhere
+*   next is the counters of the next running thread
+*/
+struct profile_counters
 {
-      cache_line_size = size;
-      
-      // caculate the total memory pages
-      memory_pages = _caculateTotalBlocks(memory_size);
+       atomic<unsigned long> calls[NUMBER_OF_PROFILE_PHASES];
+       atomic<unsigned long> ticks[NUMBER_OF_PROFILE_PHASES];
+       profile_counters *next;
        
-      //cout<< "Total Memory Pages=" << memory_pages << endl; 
-}
+       profile_counters(); // add the counters of a new thread to the running threads
+       ~profile_counters(); // keep the counts of a thread which ends
+};
 
-void cacheSize(int chipID, obj_size size)
-{
-     // check cacheLineSize and cacheSize
-     if(cache_line_size.unit > size.unit || (cache_line_size.unit == size.unit && cache_line_size.data > size.data))
-     {
-         cout << "_checkValidInput::CacheLineSize is bigger than CacheSize, invalid input!" << endl;
-         exit(1);                       
-     }
-     
-     // if chipID=-1, means no chipID from input
-     // if chipID!=-1, set specified number for that chip 
-     if(chipID == -1) 
-     {
-         if(number_of_chips > 1)
-         {
-             cache_size_l3 = size;
-             total_block_l3 = _caculateTotalBlocks(size);
-             
-             // construct and initialize TLB for L3
-             tlb_l3 = new entry[total_block_l3];
-             
-             for(int i=0; i<total_block_l3; i++) 
-             {
-                 tlb_l3[i].valid = 0;
-                 tlb_l3[i].state = 'I';
-                 tlb_l3[i].block_id = -1;
-                 tlb_l3[i].memory_page = 0;   
-             }
-             
-             // construct and initialize the L3 usage array
-             array_usage_l3 = new int[total_block_l3];
-             
-             for(int i=0; i<total_block_l3; i++)
-             {
-                 array_usage_l3[i] = -1;            
-             }
-             
-             cout << "L3=" << cache_size_l3.data << UnitSizeNames[cache_size_l3.unit] << endl;
-             cout<< "Total L3 Blocks=" << total_block_l3 << endl;
-             return;                  
-         }
-         else
-         {
-             chipID = 0;
-         }
-     } 
-    
-     // initialize L2 of current chip
-     chip currentChip;
-     
-     currentChip.cache_size_l2 = size;
-     currentChip.total_block_l2 = _caculateTotalBlocks(size);
-     
-     // construct and initialize TLB for L2
-     int length = currentChip.total_block_l2;
-     currentChip.tlb_l2 = new entry[length];
-         
-     for(int i=0; i<length; i++) 
-     {
-         currentChip.tlb_l2[i].valid = 0;
-         currentChip.tlb_l2[i].state = 'I';
-         currentChip.tlb_l2[i].block_id = -1;
-         currentChip.tlb_l2[i].memory_page = 0;        
-     } 
-         
-     // construct and initialize the L2 usage array
-     currentChip.array_usage_l2 = new int[length];
-              
-     for(int i=0; i<length; i++)
-     {
-         currentChip.array_usage_l2[i] = -1;            
-     }    
-     
-     // set it into array_chips
-     array_chips[chipID] = currentChip;
-     
-     // print chip info
-    
-     //cout << "Chip " << chipID << ", L2=" << array_chips[chipID].cache_size_l2.data
-     //<< UnitSizeNames[array_chips[chipID].cache_size_l2.unit] 
-     //<< ", Total L2 Blocks=" << array_chips[chipID].total_block_l2 << endl;
-}
+/*
+* the rings, threads and counters the Simulator only points to
+*/
+struct token_ring : spsc_ring<output_token, OUTPUT_RING_SIZE>{};
+struct batch_ring : spsc_ring<shard_batch, SHARD_RING_SIZE>{};
+struct coherence_line_ring : spsc_ring<coherence_line, COHERENCE_RING_SIZE>{};
+struct coherence_event_ring : spsc_ring<coherence_event, COHERENCE_RING_SIZE>{};
+struct chip_order_ring : spsc_ring<int, COHERENCE_RING_SIZE>{};
 
-void cacheAccessSpeed(int chipID, obj_time time)
-{
-     // if chipID=-1, means no chipID from input
-     // if chipID!=-1, set specified number for that chip 
-     if(chipID == -1) 
-     {
-         if(number_of_chips > 1)
-         {
-             cache_access_speed_l3 = time;
-             
-             cout << "L3 Access Speed=" << cache_access_speed_l3.data << UnitTimeNames[cache_access_speed_l3.unit] << endl;
-             return;                  
-         }
-         else
-         {
-              chipID = 0;
-         }
-     } 
-    
-     array_chips[chipID].cache_access_speed_l2= time;
-     
-     // print chip info
-     //cout << "Chip " << chipID << ", L2 Access Speed=" << array_chips[chipID].cache_access_speed_l2.data 
-     //<< UnitTimeNames[array_chips[chipID].cache_access_speed_l2.unit] << endl;
-}
+struct worker_thread : thread{
+       using thread::operator=;
+};
+
+struct line_counter : atomic<unsigned long>{
+       line_counter() : atomic<unsigned long>(0){}
+};
+
+/*
+* funcNames[NUMBER_OF_COMMANDS] is an array to record function names for ordering and usage
+*/
+string funcNames[NUMBER_OF_COMMANDS] = {"memorySize", "numOfChips",
+                       "numOfCores", "cacheLineSize",
+                       "cacheSize", "cacheAccessSpeed",
+                       "replacementSpeed", "broadcastSpeed", "memoryAccessSpeed",
+                       "cacheAssociativity", "read", "write"};
+
+/*
+* binary trace format, version 1, in host byte order (little endian on x86)
+*   a trace_header, then one trace_record for each command,
+*   the configuration commands before the first read or write are counted in the header
+*/
+#define TRACE_MAGIC "CCTB"
+#define TRACE_VERSION 1
 
-void replacementSpeed(obj_time time)
+/*
+* struct trace_header
+*	magic is "CCTB" to recognize a binary trace
+* 	version is the version of the format
+*   config_records is the number of configuration records before the first read or write
+*   record_size is the size of each record in bytes
+*/
+struct trace_header
 {
-     replacement_speed = time;
-     
-     //cout << "Replacement Speed=" << replacement_speed.data << UnitTimeNames[replacement_speed.unit] << endl;
-}
+       char magic[4];
+       uint32_t version;
+       uint32_t config_records;
+       uint32_t record_size;
+};
 
-void broadcastSpeed(obj_time time)
+/*
+* struct trace_record, one command in fixed width
+*	type is the command_type
+* 	unit is the unit of size or time
+*   chip_id is the chip ID, -1 means no chip ID
+*   number is the core ID for read and write, or the number of the command
+*   address is the memory address for read and write
+*   data is the number part of size or time
+*/
+struct trace_record
 {
-     broadcast_speed = time;
-     
-     //cout << "Broadcast Speed=" << broadcast_speed.data << UnitTimeNames[broadcast_speed.unit] << endl;
-}
+       uint8_t type;
+       uint8_t unit;
+       int16_t chip_id;
+       int32_t number;
+       uint64_t address;
+       uint64_t data;
+};
+
+/*
+* the decompression thread passes decoded chunks to the command loop through
+* CHUNK_SLOTS buffers of CHUNK_SIZE bytes each
+*/
+#define CHUNK_SIZE (1 << 20)
+#define CHUNK_SLOTS 4
 
-void memoryAccessSpeed(obj_time time)
+/*
+* struct chunk_queue, a bounded queue of decoded chunks
+*	buffers is the memory of each slot
+* 	lengths is the number of decoded bytes in each slot
+*   head is the first filled slot, and count is the number of filled slots,
+*   the slot after the filled ones belongs to the decompression thread
+*   done is set when the decompression thread has no more chunks
+*   error is the message if decompression failed, NULL if not
+*/
+struct chunk_queue
 {
-     memory_access_speed = time;
-     
-     //cout << "Memory Access Speed=" << memory_access_speed.data << UnitTimeNames[memory_access_speed.unit] << endl;
-}
+       char *buffers[CHUNK_SLOTS];
+       size_t lengths[CHUNK_SLOTS];
+       int head;
+       int count;
+       bool done;
+       const char *error;
+       mutex lock;
+       condition_variable not_empty;
+       condition_variable not_full;
+};
 
-void read(int chipID, int coreID, string address, obj_size size)
+/*
+* struct parsed_line, one command passed from the parsing stage to the simulation stage
+*	cmd is the command
+* 	line and end are the input line to echo, line is NULL to echo the command of a binary trace
+*   error is the message if parsing failed, NULL if not
+*   done is set after the last line
+*/
+struct parsed_line
 {
-   // if(chipID == -1)
-//    {
-//        cout << "coreID=" << coreID 
-//        << ",address=" << address << ",size=" << size.data << UnitSizeNames[size.unit] << endl;      
+       command cmd;
+       const char *line;
+       const char *end;
+       const char *error;
+       bool done;
+};
+
+/*
+* a sweep runs one trace with every combination of the values of up to SWEEP_MAX_PARAMETERS parameters
+*/
+#define SWEEP_MAX_PARAMETERS 16
+
+/*
+* struct sweep_parameter, one configuration command to vary in a sweep
+*	name is the name in the table, a command name, with L3 at the end for cache L3
+* 	type is the command to change
+*   is_l3 is set to change cacheSize, cacheAssociativity or cacheAccessSpeed of cache L3, not of L2
+*   values is each value in a command, texts is the text of each value
+*   length is the number of values
+*/
+struct sweep_parameter
+{
+       const char *name;
+       command_type type;
+       bool is_l3;
+       command *values;
+       string *texts;
+       int length;
+};
+
+/*
+* struct sweep_state, the chips and cores while a sweep runs the trace with one configuration
+*	trace_chips is the number of chips in the trace
+* 	chips is the number of chips in this configuration
+*   cores is the number of cores of each chip in this configuration
+*/
+struct sweep_state
+{
+       int trace_chips;
+       int chips;
+       int *cores;
+};
+
+/*
+* a stack distance analysis starts with room for STACK_TIMES accesses and STACK_DISTANCES distances
+*/
+#define STACK_TIMES (1 << 16)
+#define STACK_DISTANCES 1024
+
+/*
+* output_buffer is the buffer of standard output, it is only written out when it is full,
+* at endl or at exit, so printing a result does not flush
+*/
+char output_buffer[1 << 16];
+
+/*
+* _findTagInSet compares the tag with the lines of one set, and returns the way that matches, -1 if none
+* it points to the widest SIMD version the running CPU supports
+*/
+int _findTagInSetScalar(const unsigned long long *lines, int length, unsigned long long tag); // compare tags one at a time
+int _findTagInSetAVX2(const unsigned long long *lines, int length, unsigned long long tag); // compare 4 tags at a time
+int _findTagInSetAVX512(const unsigned long long *lines, int length, unsigned long long tag); // compare 8 tags at a time
+int (*_selectFindTagInSet())(const unsigned long long *, int, unsigned long long); // pick a version for this CPU
+int (*_findTagInSet)(const unsigned long long *lines, int length, unsigned long long tag) = _selectFindTagInSet();
+
+const char *OptTypeNames[] = {"L2hit", "L2miss", "L3hit", "L3miss",
+                              "L2read", "L3read", "L2write", "L3write",
+                              "L2writeback", "L3writeback", "mem_read",
+                              "replace", "broadcast"}; // name array for operation
+
+const char *ExportColumnNames[EXPORT_COLUMNS] = {"kind", "seq", "chip", "core", "reads", "writes",
+                                                 "address", "page", "pages", 
+                                                 "L2hit", "L2miss", "L3hit", "L3miss",
+                                                 "L2read", "L3read", "L2write", "L3write",
+                                                 "L2writeback", "L3writeback", "mem_read",
+                                                 "replace", "broadcast", "time_ns"}; // name array for export columns
+const char *ExportKindNames[] = {"access", "core"}; // name array for kind of export rows
+
+/*
+* declare internal functions which do not use the state of a simulator
+*/
+const char *_skipSpaces(const char *str, const char *end); // skip white space from the start of a string until end
+const char *_parseCommand(const char *line, const char *end, command *cmd); // parse one input line into a command in a single pass, return the error message or NULL
+void _checkParseError(const char *error); // print the error of parsing or of a command and exit, if any
+bool _scanDigits(const char **start, const char *end, unsigned long *data); // read the decimal digits of an argument
+const char *_getSize(const char *start, const char *end, obj_size *size); // get size from an argument
+const char *_getTime(const char *start, const char *end, obj_time *time); // get time from an argument
+const char *_getNumber(const char *start, const char *end, int *number); // get number from an argument
+const char *_getAddress(const char *start, const char *end, unsigned long *address); // get hexadecimal address from an argument
+void _checkTraceHeader(const trace_header *header); // check the magic and version of a binary trace
+void _parseStage(spsc_ring<parsed_line, LINE_RING_SIZE> *lines, const char *data, size_t length, bool isBinary); // parse a mapped trace into the line ring
+void _decompressTrace(chunk_queue *queue, const char *data, size_t length, trace_compression compression); // decode a compressed trace into the chunk queue
+char *_acquireChunk(chunk_queue *queue); // wait for an empty slot to decode into
+void _commitChunk(chunk_queue *queue, size_t length); // pass the decoded slot to the command loop
+void _finishChunks(chunk_queue *queue, const char *error); // tell the command loop there are no more chunks
+const char *_takeChunk(chunk_queue *queue, size_t *length); // wait for the next decoded chunk, NULL if no more
+void _releaseChunk(chunk_queue *queue); // give the slot of the chunk back to the decompression thread
+void _convertTextTrace(const char *fileName); // convert the text trace from standard input into a binary trace file
+void _commandToRecord(const command *cmd, trace_record *record); // pack a command into a binary trace record
+const char *_recordToCommand(const trace_record *record, command *cmd); // unpack a binary trace record into a command, return the error message or NULL
+void _initLRUList(lru_list *list, unsigned long totalBlocks, int numberOfSets); // construct an empty LRU order for each set of a cache
+void _freeLRUList(lru_list *list); // release the LRU order of a cache
+void _moveToLRUTail(lru_list *list, int setIndex, int tlbIndex); // mark an entry as the most recently used in its set
+int _popLRUHead(lru_list *list, int setIndex); // take the least recently used entry of a set out of the order
+void _initPageIndex(page_index *index, unsigned long totalBlocks); // construct an empty page index for a cache
+unsigned long _hashPage(unsigned long page, unsigned long mask); // get the first bucket of a page in a page index
+int _findPageInIndex(page_index *index, unsigned long page); // get TLB index of a page, -1 if not cached
+void _addPageToIndex(page_index *index, unsigned long page, int tlbIndex); // add or move a page in the index
+void _removePageFromIndex(page_index *index, unsigned long page); // remove a page from the index
+void _freePageIndex(page_index *index); // release the page index of a cache
+void _initBlockBitmap(block_bitmap *bitmap, unsigned long totalBlocks, int numberOfSets); // mark all blocks of a cache as empty
+void _freeBlockBitmap(block_bitmap *bitmap); // release the empty block bitmap of a cache
+int _takeEmptyBlock(block_bitmap *bitmap, int setIndex, int numberOfWays); // take the first empty block of a set, -1 if the set is full
+void _initMemoL2(chip *currentChip); // construct an empty memo for each core of a chip, release the old one
+unsigned long long _makeLine(unsigned long page, int owner, char state); // pack a valid line
+unsigned long _getLinePage(unsigned long long line); // get page ID from a line
+int _getLineOwner(unsigned long long line); // get owner from a line
+char _getLineState(unsigned long long line); // get status from a line
+unsigned long long _setLineOwner(unsigned long long line, int owner); // change owner of a line
+unsigned long long _setLineState(unsigned long long line, char state); // change status of a line
+void _initLineResult(line_result *result); // construct an empty line result
+void _addLineResult(line_result *result, int blockID, char state); // record a line used by this read or write
+void _writeNumber(FILE *file, unsigned long number); // write a decimal number to a file
+void _writeHex(FILE *file, unsigned long number); // write a hexadecimal number with "0x" to a file
+void _addStats(core_stats *total, const core_stats *stats); // add the counters of stats into total
+int _runSimulatorCommand(simulator *sim, command_type type, int chipID, int number, unsigned long data, int unit); // fill a command from the C interface and run it, 0 or -1
+int _trySimulatorCommand(simulator *sim, const command *cmd); // run a command from the C interface if it can run, 0 or -1 and keep its error
+void _recordCommand(sweep_trace *trace, const command *cmd); // append a command to a trace in memory
+void _freeSweepTrace(sweep_trace *trace); // release a trace in memory
+void _parseSweepParameter(sweep_parameter *parameter, const char *spec); // parse "name=value,value,..." of a sweep
+void _freeSweepParameter(sweep_parameter *parameter); // release the values of a sweep parameter
+void _runSweep(const sweep_trace *trace, const sweep_parameter parameters[], int count, int threads); // run every configuration of a sweep on a pool of threads and print the table
+void _sweepWorker(const sweep_trace *trace, const sweep_parameter parameters[], int count, atomic<unsigned long> *next, unsigned long points, core_stats results[]); // run configurations until none is left
+void _runSweepPoint(const sweep_trace *trace, const sweep_parameter parameters[], int count, unsigned long point, core_stats *result); // run the trace with one configuration of a sweep
+void _runSweepConfig(Simulator *simulator, const command *cmd, const sweep_parameter parameters[], int count, const int values[], sweep_state *state); // run one configuration command with the values of a sweep
+void _initStackDistance(stack_distance *stack); // construct an empty stack distance analysis
+void _freeStackDistance(stack_distance *stack); // release a stack distance analysis
+unsigned long _addStackAccess(stack_distance *stack, unsigned long line); // find the stack distance of one access to a line, -1 for the first access
+void _growStackLines(stack_distance *stack); // double the buckets for the last access of each line
+void _packStackTimes(stack_distance *stack); // renumber the last accesses from time 0, and make room for new times
+void _addFenwick(long *tree, unsigned long capacity, unsigned long position, long delta); // add delta at a position of a Fenwick tree
+long _sumFenwick(const long *tree, unsigned long length); // sum the positions before length of a Fenwick tree
+
+/*
+* put an item at the tail of a ring, wait if the ring is full
+*/
+template <typename T, int N>
+void _pushRing(spsc_ring<T, N> *ring, const T &item)
+{
+    unsigned long tail = ring->tail.load(memory_order_relaxed);
+    
+    while(tail - ring->head.load(memory_order_acquire) == N) {this_thread::yield();};
+    
+    ring->items[tail % N] = item;
+    ring->tail.store(tail + 1, memory_order_release);
+}
+
+/*
+* get the item at the head of a ring without taking it, NULL if the ring is empty
+*/
+template <typename T, int N>
+T *_tryPeekRing(spsc_ring<T, N> *ring)
+{
+    unsigned long head = ring->head.load(memory_order_relaxed);
+    
+    if(ring->tail.load(memory_order_acquire) == head) return NULL;
+    
+    return &ring->items[head % N];
+}
+
+/*
+* get the item at the head of a ring without taking it, wait if the ring is empty
+*/
+template <typename T, int N>
+T *_peekRing(spsc_ring<T, N> *ring)
+{
+    unsigned long head = ring->head.load(memory_order_relaxed);
+    
+    while(ring->tail.load(memory_order_acquire) == head) {this_thread::yield();};
+    
+    return &ring->items[head % N];
+}
+
+/*
+* take the item at the head of a ring after it is used
+*/
+template <typename T, int N>
+void _popRing(spsc_ring<T, N> *ring)
+{
+    ring->head.store(ring->head.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+/*
+* class drain_buffer is the buffer of cout while the pipeline runs,
+* messages wait for the formatting stage so they keep their order in the output
+*/
+class drain_buffer : public streambuf
+{
+public:
+    drain_buffer(Simulator *simulator) : simulator(simulator) {}
+    
+protected:
+    int overflow(int c)
+    {
+        simulator->_drainOutput();
+        return (c == EOF) ? 0 : putchar(c);
+    }
+    
+    streamsize xsputn(const char *str, streamsize length)
+    {
+        simulator->_drainOutput();
+        return fwrite(str, 1, length, stdout);
+    }
+    
+    int sync()
+    {
+        simulator->_drainOutput();
+        return fflush(stdout);
+    }
+    
+private:
+    Simulator *simulator; // the simulator whose pipeline output goes first
+};
+
+#ifdef CACHE_PROFILE
+const char *ProfilePhaseNames[] = {"access", "parse", "get", "validate", "check_l2", "check_l3",
+                                   "lru", "write_l2", "write_l3", "load_l2", "invalidate", "print"}; // name array for profile phases
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PROFILE_UNIT "cycles" // the unit of the ticks of the profile
+#else
+#define PROFILE_UNIT "ns"
+#endif
+
+/*
+* read the ticks of the profile, TSC cycles on x86, ns elsewhere
+*/
+inline unsigned long _readProfileTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+mutex ProfileMutex; // guards the list of running threads and the counts of ended threads
+profile_counters *ProfileThreads = NULL; // the counters of each running thread
+unsigned long ProfileEndedCalls[NUMBER_OF_PROFILE_PHASES] = {}; // the calls of threads which ended
+unsigned long ProfileEndedTicks[NUMBER_OF_PROFILE_PHASES] = {}; // the ticks of threads which ended
+unsigned long ProfileStart = _readProfileTicks(); // the ticks when the program starts
+thread_local profile_counters ProfileCounters; // the counters of this thread
+class profile_scope;
+thread_local profile_scope *ProfileOpenScope = NULL; // the innermost block being timed on this thread
+
+void _printProfile(); // print the calls and ticks of each phase to standard error
+
+/*
+* class profile_scope times the block it is declared in as one call of a phase,
+* the blocks open on a thread form a stack, and the time of an inner block is only counted in its own phase
+*/
+class profile_scope
+{
+public:
+    profile_scope(profile_phase phase) : phase(phase), start(_readProfileTicks()), inner(0), outer(ProfileOpenScope)
+    {
+        ProfileOpenScope = this;
+    }
+    
+    ~profile_scope()
+    {
+        // only this thread writes its counters, so there is no read-modify-write
+        profile_counters *counters = &ProfileCounters;
+        unsigned long elapsed = _readProfileTicks() - start;
+        
+        counters->calls[phase].store(counters->calls[phase].load(memory_order_relaxed) + 1, memory_order_relaxed);
+        counters->ticks[phase].store(counters->ticks[phase].load(memory_order_relaxed) + elapsed - inner, memory_order_relaxed);
+        
+        if(outer != NULL)
+        {
+            outer->inner += elapsed;
+        }
+        
+        ProfileOpenScope = outer;
+    }
+    
+private:
+    profile_phase phase; // the phase of this block
+    unsigned long start; // the ticks at the start of this block
+    unsigned long inner; // the ticks of the blocks timed inside this one
+    profile_scope *outer; // the block this one is timed inside, NULL if none
+};
+
+profile_counters::profile_counters()
+{
+    for(int i=0; i<NUMBER_OF_PROFILE_PHASES; i++)
+    {
+        calls[i].store(0, memory_order_relaxed);
+        ticks[i].store(0, memory_order_relaxed);
+    }
+    
+    lock_guard<mutex> lock(ProfileMutex);
+    
+    next = ProfileThreads;
+    ProfileThreads = this;
+}
+
+profile_counters::~profile_counters()
+{
+    lock_guard<mutex> lock(ProfileMutex);
+    profile_counters **link = &ProfileThreads;
+    
+    while(*link != this)
+    {
+        link = &(*link)->next;
+    }
+    
+    *link = next;
+    
+    for(int i=0; i<NUMBER_OF_PROFILE_PHASES; i++)
+    {
+        ProfileEndedCalls[i] += calls[i].load(memory_order_relaxed);
+        ProfileEndedTicks[i] += ticks[i].load(memory_order_relaxed);
+    }
+}
+
+void _printProfile()
+{
+    lock_guard<mutex> lock(ProfileMutex);
+    unsigned long total = _readProfileTicks() - ProfileStart;
+    unsigned long calls[NUMBER_OF_PROFILE_PHASES];
+    unsigned long ticks[NUMBER_OF_PROFILE_PHASES];
+    unsigned long phaseTotal = 0;
+    
+    for(int i=0; i<NUMBER_OF_PROFILE_PHASES; i++)
+    {
+        calls[i] = ProfileEndedCalls[i];
+        ticks[i] = ProfileEndedTicks[i];
+        
+        for(profile_counters *counters = ProfileThreads; counters != NULL; counters = counters->next)
+        {
+            calls[i] += counters->calls[i].load(memory_order_relaxed);
+            ticks[i] += counters->ticks[i].load(memory_order_relaxed);
+        }
+        
+        phaseTotal += ticks[i];
+    }
+    
+    // the phases do not include the phases they call, and the threads add up,
+    // so a share is of the time in all phases, not of the time of the program
+    fprintf(stderr, "profile: total %s=%lu phases %s=%lu\n", PROFILE_UNIT, total, PROFILE_UNIT, phaseTotal);
+    
+    for(int i=0; i<NUMBER_OF_PROFILE_PHASES; i++)
+    {
+        fprintf(stderr, "profile %s: calls=%lu %s=%lu per_call=%.1f share=%.1f%%\n", ProfilePhaseNames[i], calls[i], PROFILE_UNIT, ticks[i],
+                calls[i] > 0 ? (double)ticks[i] / calls[i] : 0.0, phaseTotal > 0 ? 100.0 * ticks[i] / phaseTotal : 0.0);
+    }
+}
+#endif
+
+#ifndef CACHE_LIBRARY
+/*
+* main function, this is the program entry to invoke all other functions
+*/
+int main(int argc, char *argv[])
+{
+    const char *fileName = NULL;
+    const char *binaryName = NULL;
+    bool isBinary = 0;
+    bool isPipeline = 0;
+    const char *exportFormat = NULL;
+    const char *exportName = NULL;
+    sweep_parameter sweepParameters[SWEEP_MAX_PARAMETERS];
+    int sweepCount = 0;
+    int sweepThreads = 0;
+    int shardThreads = 0;
+    bool isStaged = 0;
+    bool isAnalysis = 0;
+    sweep_trace trace = sweep_trace();
+    Simulator simulator;
+    
+    // -b binary trace from standard input, -p pipeline for a trace file,
+    // -q only the summary, -s N the summary every N reads and writes, -c convert into a binary trace,
+    // -e format file export statistics as csv, jsonl or columnar,
+    // -w name=value,... sweep a configuration command over values, -j N run the sweep on N threads,
+    // -m print the miss ratio curves from the stack distances instead of simulating, L3 behind L2 of the sizes in the trace,
+    // -t N only the summary, with the sets of the caches simulated on N threads, 0 for the cores of this host,
+    // -l only the summary, with L2 of each chip simulated on its own thread and L3 on another
+    for(int i=1; i<argc; i++)
+    {
+        if(strcmp(argv[i], "-b") == 0)
+        {
+            isBinary = 1;
+        }
+        else if(strcmp(argv[i], "-p") == 0)
+        {
+            isPipeline = 1;
+        }
+        else if(strcmp(argv[i], "-m") == 0)
+        {
+            isAnalysis = 1;
+        }
+        else if(strcmp(argv[i], "-l") == 0)
+        {
+            isStaged = 1;
+        }
+        else if(strcmp(argv[i], "-q") == 0)
+        {
+            simulator.quiet_output = 1;
+        }
+        else if(strcmp(argv[i], "-s") == 0 && i+1 < argc && isdigit((unsigned char)argv[i+1][0]))
+        {
+            simulator.stats_interval = strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "-c") == 0 && i+1 < argc)
+        {
+            binaryName = argv[++i];
+        }
+        else if(strcmp(argv[i], "-e") == 0 && i+2 < argc)
+        {
+            exportFormat = argv[++i];
+            exportName = argv[++i];
+        }
+        else if(strcmp(argv[i], "-w") == 0 && i+1 < argc && sweepCount < SWEEP_MAX_PARAMETERS)
+        {
+            _parseSweepParameter(&sweepParameters[sweepCount++], argv[++i]);
+        }
+        else if(strcmp(argv[i], "-j") == 0 && i+1 < argc && isdigit((unsigned char)argv[i+1][0]))
+        {
+            sweepThreads = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "-t") == 0 && i+1 < argc && isdigit((unsigned char)argv[i+1][0]))
+        {
+            shardThreads = atoi(argv[++i]);
+            
+            if(shardThreads < 1)
+            {
+                shardThreads = thread::hardware_concurrency();
+            }
+        }
+        else if(argv[i][0] != '-' && fileName == NULL)
+        {
+            fileName = argv[i];
+        }
+        else
+        {
+            cout << "Usage: " << argv[0] << " [-q] [-s N] [-e csv|jsonl|columnar file] [-b] < trace, " 
+                 << argv[0] << " [-q] [-s N] [-e csv|jsonl|columnar file] [-p] traceFile, " 
+                 << argv[0] << " -t threads|-l [-s N] [-b] [-p] [traceFile] < trace, " 
+                 << argv[0] << " -w name=value,... [-w ...] [-j threads] [-b] [traceFile] < trace, " 
+                 << argv[0] << " -m [-b] [-p] [traceFile] < trace, or " 
+                 << argv[0] << " -c binaryTrace < trace" << endl;
+            exit(1);
+        }
+    }
+    
+    // convert a text trace into a binary trace without simulating
+    if(binaryName != NULL)
+    {
+        _convertTextTrace(binaryName);
+        return EXIT_SUCCESS;
+    }
+    
+    // collect output in one buffer
+    setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+    
+    // a sweep keeps the trace in memory, then runs it once for each configuration
+    if(sweepCount > 0)
+    {
+        simulator.quiet_output = 1;
+        simulator.record_trace = &trace;
+    }
+    
+    // the sets of the caches are split over the threads, the lines of each read or write go to their sets
+    if(shardThreads > 0)
+    {
+        simulator.quiet_output = 1;
+        simulator.shard_threads = shardThreads;
+    }
+    
+    // L2 of each chip runs on its own thread, the lines which need L3 are resolved in order on another
+    if(isStaged)
+    {
+        simulator.quiet_output = 1;
+        simulator.chip_threads = 1;
+    }
+    
+    // the stack distances give the misses of every cache size in one pass
+    if(isAnalysis)
+    {
+        simulator.quiet_output = 1;
+        simulator.stack_analysis = 1;
+    }
+    
+    if(exportFormat != NULL)
+    {
+        simulator.openExport(exportFormat, exportName);
+    }
+    
+    if(fileName != NULL)
+    {
+        simulator.runTraceFile(fileName, isPipeline);
+    }
+    else if(isBinary)
+    {
+        simulator.runBinaryTrace(stdin);
+    }
+    else
+    {
+        simulator.runTextTrace();
+    }
+    
+    if(sweepCount > 0)
+    {
+        _runSweep(&trace, sweepParameters, sweepCount, sweepThreads);
+        _freeSweepTrace(&trace);
+        
+        for(int i=0; i<sweepCount; i++)
+        {
+            _freeSweepParameter(&sweepParameters[i]);
+        }
+        
+        if(exportFormat != NULL)
+        {
+            simulator.closeExport();
+        }
+        
+#ifdef CACHE_PROFILE
+        _printProfile();
+#endif
+        
+        return EXIT_SUCCESS;
+    }
+    
+    // the summary at the end of the run
+    if(isAnalysis)
+    {
+        simulator.printMissRatioCurves();
+    }
+    else if(simulator.quiet_output || simulator.stats_interval > 0)
+    {
+        simulator.printStats();
+    }
+    
+    if(exportFormat != NULL)
+    {
+        simulator.closeExport();
+    }
+    
+#ifdef CACHE_PROFILE
+    _printProfile();
+#endif
+    
+    return EXIT_SUCCESS;
+}
+#endif
+
+Simulator::Simulator()
+{
+    // the caches of L3 are built by the commands, only the empty structs are made here
+    index_l3 = new page_index();
+    lru_l3 = new lru_list();
+    bitmap_l3 = new block_bitmap();
+    stack_l3 = new stack_distance();
+    
+    // prepare the result of a read or write
+    result_l2 = new line_result();
+    result_l3 = new line_result();
+    _initLineResult(result_l2);
+    _initLineResult(result_l3);
+}
+
+Simulator::~Simulator()
+{
+    if(shards != NULL)
+    {
+        _stopShards();
+    }
+    
+    if(stages != NULL)
+    {
+        _stopStages();
+    }
+    
+    for(int i=0; chip_stats != NULL && i<number_of_chips; i++)
+    {
+        delete[] chip_stats[i];
+    }
+    
+    for(int i=0; stack_l2 != NULL && i<number_of_chips; i++)
+    {
+        _freeStackDistance(&stack_l2[i]);
+    }
+    
+    if(stack_l2 != NULL)
+    {
+        delete[] stack_l2;
+        _freeStackDistance(stack_l3);
+    }
+    
+    _freeChips();
+    delete[] tlb_l3;
+    _freePageIndex(index_l3);
+    _freeLRUList(lru_l3);
+    _freeBlockBitmap(bitmap_l3);
+    delete[] chip_stats;
+    delete[] stats_cores;
+    delete[] result_l2->block;
+    delete[] result_l2->state;
+    delete[] result_l3->block;
+    delete[] result_l3->state;
+    delete index_l3;
+    delete lru_l3;
+    delete bitmap_l3;
+    delete stack_l3;
+    delete result_l2;
+    delete result_l3;
+    
+#ifdef CACHE_KERNEL_HOOKS
+    if(kernel_bitmap != NULL)
+    {
+        _freeBlockBitmap(kernel_bitmap);
+        delete kernel_bitmap;
+    }
+#endif
+}
+
+void Simulator::runCommand(const command *cmd)
+{
+    // a sweep loads the trace first, the commands run later for each configuration
+    if(record_trace != NULL)
+    {
+        _recordCommand(record_trace, cmd);
+        return;
+    }
+    
+    // the IDs of a read or write are checked after its address is printed
+    _checkParseError(cmd->type < CMD_READ ? _checkCommand(cmd) : _checkCommandsReady());
+    _checkParseError(_callCommand(cmd));
+}
+
+const char *Simulator::_callCommand(const command *cmd)
+{
+    switch(cmd->type)
+    {
+        // call memorySize function
+        case CMD_MEMORY_SIZE:
+            commands[0] = 1;
+            memorySize(cmd->size);
+            break;
+        
+        // call numOfChips function, optional, if not input, means 1 chip 
+        case CMD_NUM_OF_CHIPS:
+            commands[1] = 1;
+            numOfChips(cmd->number);
+            break;
+        
+        // call numOfCores function, if not input Chip ID, means the same number for all chips 
+        case CMD_NUM_OF_CORES:
+            commands[2] = 1;
+            numOfCores(cmd->chip_id, cmd->number);
+            break;
+        
+        // call cacheLineSize function 
+        case CMD_CACHE_LINE_SIZE:
+            commands[3] = 1;
+            cacheLineSize(cmd->size);
+            break;
+        
+        // call cacheSize function
+        case CMD_CACHE_SIZE:
+            commands[4] = 1;
+            cacheSize(cmd->chip_id, cmd->size);
+            break;
+        
+        // call cacheAssociativity function, optional, if not input, caches are fully associative
+        case CMD_CACHE_ASSOCIATIVITY:
+            commands[9] = 1;
+            cacheAssociativity(cmd->chip_id, cmd->number);
+            break;
+        
+        // call cacheAccessSpeed function
+        case CMD_CACHE_ACCESS_SPEED:
+            commands[5] = 1;
+            cacheAccessSpeed(cmd->chip_id, cmd->time);
+            break;
+        
+        // call replacementSpeed function
+        case CMD_REPLACEMENT_SPEED:
+            commands[6] = 1;
+            replacementSpeed(cmd->time);
+            break;
+        
+        // call broadcastSpeed function
+        case CMD_BROADCAST_SPEED:
+            commands[7] = 1;
+            broadcastSpeed(cmd->time);
+            break;
+        
+        // call memoryAccessSpeed function
+        case CMD_MEMORY_ACCESS_SPEED:
+            commands[8] = 1;
+            memoryAccessSpeed(cmd->time);
+            break;
+        
+        // call read function
+        case CMD_READ:
+            return _readAddress(cmd->chip_id, cmd->number, cmd->address, cmd->size);
+        
+        // call write function
+        case CMD_WRITE:
+            return _writeAddress(cmd->chip_id, cmd->number, cmd->address, cmd->size);
+        
+        // not match with any function name
+        default:
+            _outputString("Not found expected function, skip it!\n");
+            break;
+    }
+    
+    return NULL;
+}
+
+const char *Simulator::tryCommand(const command *cmd)
+{
+    const char *error = _checkCommand(cmd);
+    
+    if(error == NULL)
+    {
+        error = _callCommand(cmd);
+    }
+    
+    return error;
+}
+
+const char *Simulator::tryAccess(int chipID, int coreID, unsigned long address, unsigned long bytes, bool isWrite)
+{
+    command cmd = {isWrite ? CMD_WRITE : CMD_READ, chipID, coreID, address, {bytes, B}, {}};
+    const char *error = _checkCommandsReady();
+    
+    if(error != NULL)
+    {
+        return error;
+    }
+    
+    // the lines from the one of address to the one of its last byte, the address is in the unit of the line like a trace,
+    // they run as the same number of whole lines from the start of the first one
+    unsigned long scale = 1UL << (cache_line_size.unit*10);
+    unsigned long first = address / cache_line_size.data;
+    unsigned long lines = bytes == 0 ? 0 : (address * scale + bytes - 1) / (cache_line_size.data * scale) - first + 1;
+    
+    cmd.address = first * cache_line_size.data;
+    cmd.size.data = lines * cache_line_size.data;
+    cmd.size.unit = cache_line_size.unit;
+    
+    return tryCommand(&cmd);
+}
+
+void Simulator::runTextTrace()
+{
+    string strLine;
+    
+    while(getline(cin, strLine))
+    {
+        _runTextLine(strLine.c_str(), strLine.c_str() + strLine.size());
+    }
+}
+
+void Simulator::_runTextLine(const char *line, const char *end)
+{
+    command cmd;
+    
+    // skip blank lines and comment lines
+    const char *pos = _skipSpaces(line, end);
+    
+    if(pos == end || *pos == '#') return;
+    
+    _echoLine(line, end);
+    
+    _checkParseError(_parseCommand(pos, end, &cmd));
+    runCommand(&cmd);
+}
+
+void Simulator::runBinaryTrace(FILE *file)
+{
+    trace_header header;
+    trace_record records[4096];
+    command cmd;
+    size_t count;
+    
+    if(fread(&header, sizeof(header), 1, file) != 1)
+    {
+        cout << "_runBinaryTrace::Not found expected binary trace header, invalid input!" << endl;
+        exit(1);
+    }
+    
+    _checkTraceHeader(&header);
+    
+    // read records in blocks, echo each command in text form before running it
+    while((count = fread(records, sizeof(trace_record), sizeof(records)/sizeof(trace_record), file)) > 0)
+    {
+        for(size_t i=0; i<count; i++)
+        {
+            _checkParseError(_recordToCommand(&records[i], &cmd));
+            _outputCommand(&cmd);
+            runCommand(&cmd);
+        }
+    }
+    
+    if(ferror(file))
+    {
+        cout << "_runBinaryTrace::Failed to read binary trace!" << endl;
+        exit(1);
+    }
+}
+
+void _checkTraceHeader(const trace_header *header)
+{
+    if(memcmp(header->magic, TRACE_MAGIC, 4) != 0)
+    {
+        cout << "_checkTraceHeader::Not found expected binary trace header, invalid input!" << endl;
+        exit(1);
+    }
+    
+    if(header->version != TRACE_VERSION || header->record_size != sizeof(trace_record))
+    {
+        cout << "_checkTraceHeader::Unsupported binary trace version " << header->version << ", invalid input!" << endl;
+        exit(1);
+    }
+}
+
+void Simulator::runTraceFile(const char *fileName, bool isPipeline)
+{
+    struct stat status;
+    
+    int fd = open(fileName, O_RDONLY);
+    
+    if(fd < 0 || fstat(fd, &status) != 0)
+    {
+        cout << "_runTraceFile::Can not open " << fileName << "!" << endl;
+        exit(1);
+    }
+    
+    size_t length = status.st_size;
+    
+    // nothing to run for an empty file, and it can not be mapped
+    if(length == 0)
+    {
+        close(fd);
+        return;
+    }
+    
+    char *data = (char *)mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    
+    if(data == MAP_FAILED)
+    {
+        cout << "_runTraceFile::Can not map " << fileName << "!" << endl;
+        exit(1);
+    }
+    
+    // the trace is read once from start to end
+    madvise(data, length, MADV_SEQUENTIAL);
+    
+    if(length >= 2 && (unsigned char)data[0] == 0x1f && (unsigned char)data[1] == 0x8b)
+    {
+        _runCompressedTrace(data, length, TRACE_GZIP);
+    }
+    else if(length >= 4 && memcmp(data, "\x28\xb5\x2f\xfd", 4) == 0)
+    {
+        _runCompressedTrace(data, length, TRACE_ZSTD);
+    }
+    else if(length >= sizeof(trace_header) && memcmp(data, TRACE_MAGIC, 4) == 0)
+    {
+        // binary trace, records follow the header in place
+        command cmd;
+        
+        _checkTraceHeader((const trace_header *)data);
+        
+        const trace_record *records = (const trace_record *)(data + sizeof(trace_header));
+        size_t count = (length - sizeof(trace_header)) / sizeof(trace_record);
+        
+        if((length - sizeof(trace_header)) % sizeof(trace_record) != 0)
+        {
+            cout << "_runTraceFile::Binary trace is truncated, invalid input!" << endl;
+            exit(1);
+        }
+        
+        if(isPipeline)
+        {
+            _runPipeline((const char *)records, count * sizeof(trace_record), 1);
+            count = 0;
+        }
+        
+        for(size_t i=0; i<count; i++)
+        {
+            _checkParseError(_recordToCommand(&records[i], &cmd));
+            _outputCommand(&cmd);
+            runCommand(&cmd);
+        }
+    }
+    else
+    {
+        // text trace, parse each line straight from the mapped bytes
+        const char *pos = data;
+        const char *end = data + length;
+        
+        if(isPipeline)
+        {
+            _runPipeline(data, length, 0);
+            pos = end;
+        }
+        
+        while(pos < end)
+        {
+            const char *lineEnd = (const char *)memchr(pos, '\n', end - pos);
+            
+            if(lineEnd == NULL) lineEnd = end;
+            
+            _runTextLine(pos, lineEnd);
+            pos = lineEnd + 1;
+        }
+    }
+    
+    munmap(data, length);
+    close(fd);
+}
+
+void Simulator::_runPipeline(const char *data, size_t length, bool isBinary)
+{
+    spsc_ring<parsed_line, LINE_RING_SIZE> *lines = new spsc_ring<parsed_line, LINE_RING_SIZE>;
+    
+    output_ring = new token_ring;
+    
+    // cout messages of the simulation wait for the output before them
+    drain_buffer drainOutput(this);
+    streambuf *coutBuffer = cout.rdbuf(&drainOutput);
+    
+    thread parser(_parseStage, lines, data, length, isBinary);
+    thread formatter(&Simulator::_formatStage, this, output_ring);
+    
+    // this thread is the simulation stage
+    while(1)
+    {
+        parsed_line *item = _peekRing(lines);
+        
+        if(item->done) break;
+        
+        if(item->line != NULL)
+        {
+            _echoLine(item->line, item->end);
+        }
+        else
+        {
+            _outputCommand(&item->cmd);
+        }
+        
+        _checkParseError(item->error);
+        runCommand(&item->cmd);
+        _popRing(lines);
+    }
+    
+    _pushOutput(OUTPUT_END, NULL, 0, 0);
+    
+    parser.join();
+    formatter.join();
+    
+    cout.rdbuf(coutBuffer);
+    
+    delete output_ring;
+    output_ring = NULL;
+    delete lines;
+}
+
+void _parseStage(spsc_ring<parsed_line, LINE_RING_SIZE> *lines, const char *data, size_t length, bool isBinary)
+{
+    parsed_line item;
+    
+    item.error = NULL;
+    item.done = 0;
+    
+    if(isBinary)
+    {
+        const trace_record *records = (const trace_record *)data;
+        
+        item.line = NULL;
+        
+        for(size_t i=0; i<length/sizeof(trace_record) && item.error == NULL; i++)
+        {
+            item.error = _recordToCommand(&records[i], &item.cmd);
+            _pushRing(lines, item);
+        }
+    }
+    else
+    {
+        const char *pos = data;
+        const char *end = data + length;
+        
+        // stop after an error, the simulation stage exits there
+        while(pos < end && item.error == NULL)
+        {
+            const char *lineEnd = (const char *)memchr(pos, '\n', end - pos);
+            
+            if(lineEnd == NULL) lineEnd = end;
+            
+            // skip blank lines and comment lines
+            const char *start = _skipSpaces(pos, lineEnd);
+            
+            if(start != lineEnd && *start != '#')
+            {
+                item.line = pos;
+                item.end = lineEnd;
+                item.error = _parseCommand(start, lineEnd, &item.cmd);
+                _pushRing(lines, item);
+            }
+            
+            pos = lineEnd + 1;
+        }
+    }
+    
+    item.done = 1;
+    _pushRing(lines, item);
+}
+
+void Simulator::_formatStage(token_ring *tokens)
+{
+    while(1)
+    {
+        output_token *token = _peekRing(tokens);
+        
+        switch(token->kind)
+        {
+            case OUTPUT_STRING:
+                fputs(token->str, output);
+                break;
+            
+            case OUTPUT_TEXT:
+                fwrite(token->str, 1, token->length, output);
+                break;
+            
+            case OUTPUT_CHAR:
+                fputc((char)token->value, output);
+                break;
+            
+            case OUTPUT_NUMBER:
+                _writeNumber(output, token->value);
+                break;
+            
+            case OUTPUT_HEX:
+                _writeHex(output, token->value);
+                break;
+            
+            default:
+                _popRing(tokens);
+                return;
+        }
+        
+        _popRing(tokens);
+    }
+}
+
+void Simulator::_pushOutput(output_kind kind, const char *str, size_t length, unsigned long value)
+{
+    output_token token;
+    
+    token.kind = kind;
+    token.length = length;
+    
+    if(str != NULL)
+    {
+        token.str = str;
+    }
+    else
+    {
+        token.value = value;
+    }
+    
+    _pushRing(output_ring, token);
+}
+
+void Simulator::_drainOutput()
+{
+    if(output_ring == NULL) return;
+    
+    // head moves after a token is written, so an empty ring means all is written
+    while(output_ring->head.load(memory_order_acquire) != output_ring->tail.load(memory_order_relaxed)) 
+    {
+        this_thread::yield();
+    }
+}
+
+void Simulator::_runCompressedTrace(const char *data, size_t length, trace_compression compression)
+{
+    chunk_queue queue;
+    trace_stream stream;
+    const char *chunk;
+    size_t chunkLength;
+    
+#ifndef USE_ZLIB
+    if(compression == TRACE_GZIP)
+    {
+        cout << "_runCompressedTrace::Built without zlib, can not read a .gz trace!" << endl;
+        exit(1);
+    }
+#endif
+
+#ifndef USE_ZSTD
+    if(compression == TRACE_ZSTD)
+    {
+        cout << "_runCompressedTrace::Built without zstd, can not read a .zst trace!" << endl;
+        exit(1);
+    }
+#endif
+    
+    for(int i=0; i<CHUNK_SLOTS; i++)
+    {
+        queue.buffers[i] = (char *)malloc(CHUNK_SIZE);
+    }
+    
+    queue.head = 0;
+    queue.count = 0;
+    queue.done = 0;
+    queue.error = NULL;
+    
+    stream.kind = 0;
+    stream.has_header = 0;
+    
+    // decode on another thread, run the commands on this one
+    thread decoder(_decompressTrace, &queue, data, length, compression);
+    
+    while((chunk = _takeChunk(&queue, &chunkLength)) != NULL)
+    {
+        _feedTraceStream(&stream, chunk, chunkLength);
+        _releaseChunk(&queue);
+    }
+    
+    decoder.join();
+    
+    if(queue.error != NULL)
+    {
+        cout << "_runCompressedTrace::" << queue.error << ", invalid input!" << endl;
+        exit(1);
+    }
+    
+    _finishTraceStream(&stream);
+    
+    for(int i=0; i<CHUNK_SLOTS; i++)
+    {
+        free(queue.buffers[i]);
+    }
+}
+
+void _decompressTrace(chunk_queue *queue, const char *data, size_t length, trace_compression compression)
+{
+#if !defined(USE_ZLIB) && !defined(USE_ZSTD)
+    // built without a decoder, only the error is reported, _runCompressedTrace stops before it is started
+    (void)data;
+    (void)length;
+    (void)compression;
+#endif
+
+#ifdef USE_ZLIB
+    if(compression == TRACE_GZIP)
+    {
+        z_stream zs;
+        size_t consumed = 0;
+        int ret = Z_OK;
+        
+        memset(&zs, 0, sizeof(zs));
+        
+        // 15+32 is the largest window with gzip or zlib header detection
+        if(inflateInit2(&zs, 15 + 32) != Z_OK)
+        {
+            _finishChunks(queue, "Failed to start gzip decoder");
+            return;
+        }
+        
+        while(1)
+        {
+            // avail_in is 32 bits, give the input in pieces
+            if(zs.avail_in == 0 && consumed < length)
+            {
+                zs.next_in = (Bytef *)(data + consumed);
+                zs.avail_in = (length - consumed < (1UL << 30)) ? length - consumed : (1UL << 30);
+                consumed += zs.avail_in;
+            }
+            
+            zs.next_out = (Bytef *)_acquireChunk(queue);
+            zs.avail_out = CHUNK_SIZE;
+            
+            ret = inflate(&zs, Z_NO_FLUSH);
+            
+            if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            {
+                break;
+            }
+            
+            _commitChunk(queue, CHUNK_SIZE - zs.avail_out);
+            
+            if(ret == Z_STREAM_END)
+            {
+                // a file can hold several gzip members one after another
+                if(zs.avail_in == 0 && consumed == length) break;
+                
+                inflateReset(&zs);
+            }
+            else if(ret == Z_BUF_ERROR && zs.avail_in == 0 && consumed == length)
+            {
+                break;
+            }
+        }
+        
+        inflateEnd(&zs);
+        _finishChunks(queue, ret == Z_STREAM_END ? NULL : "Broken or truncated gzip trace");
+        return;
+    }
+#endif
+
+#ifdef USE_ZSTD
+    if(compression == TRACE_ZSTD)
+    {
+        ZSTD_DCtx *dctx = ZSTD_createDCtx();
+        ZSTD_inBuffer in = {data, length, 0};
+        ZSTD_outBuffer out;
+        size_t ret = 0;
+        
+        // keep going while there is input, or the last output was full and more may be buffered
+        do
+        {
+            out.dst = _acquireChunk(queue);
+            out.size = CHUNK_SIZE;
+            out.pos = 0;
+            
+            ret = ZSTD_decompressStream(dctx, &out, &in);
+            
+            if(ZSTD_isError(ret)) break;
+            
+            _commitChunk(queue, out.pos);
+        } while(in.pos < in.size || out.pos == out.size);
+        
+        ZSTD_freeDCtx(dctx);
+        _finishChunks(queue, ret == 0 ? NULL : "Broken or truncated zstd trace");
+        return;
+    }
+#endif
+
+    _finishChunks(queue, "Unsupported compression");
+}
+
+char *_acquireChunk(chunk_queue *queue)
+{
+    unique_lock<mutex> guard(queue->lock);
+    
+    while(queue->count == CHUNK_SLOTS)
+    {
+        queue->not_full.wait(guard);
+    }
+    
+    return queue->buffers[(queue->head + queue->count) % CHUNK_SLOTS];
+}
+
+void _commitChunk(chunk_queue *queue, size_t length)
+{
+    // an empty chunk keeps its slot for the next decode
+    if(length == 0) return;
+    
+    unique_lock<mutex> guard(queue->lock);
+    
+    queue->lengths[(queue->head + queue->count) % CHUNK_SLOTS] = length;
+    queue->count++;
+    queue->not_empty.notify_one();
+}
+
+void _finishChunks(chunk_queue *queue, const char *error)
+{
+    unique_lock<mutex> guard(queue->lock);
+    
+    queue->error = error;
+    queue->done = 1;
+    queue->not_empty.notify_one();
+}
+
+const char *_takeChunk(chunk_queue *queue, size_t *length)
+{
+    unique_lock<mutex> guard(queue->lock);
+    
+    while(queue->count == 0 && !queue->done)
+    {
+        queue->not_empty.wait(guard);
+    }
+    
+    if(queue->count == 0) return NULL;
+    
+    *length = queue->lengths[queue->head];
+    
+    return queue->buffers[queue->head];
+}
+
+void _releaseChunk(chunk_queue *queue)
+{
+    unique_lock<mutex> guard(queue->lock);
+    
+    queue->head = (queue->head + 1) % CHUNK_SLOTS;
+    queue->count--;
+    queue->not_full.notify_one();
+}
+
+void Simulator::_feedTraceStream(trace_stream *stream, const char *data, size_t length)
+{
+    const char *pos = data;
+    const char *end = data + length;
+    
+    // wait for enough bytes to tell a binary trace from a text trace
+    if(stream->kind == 0)
+    {
+        stream->carry.append(data, length);
+        
+        if(stream->carry.size() < sizeof(trace_header)) return;
+        
+        stream->kind = (memcmp(stream->carry.data(), TRACE_MAGIC, 4) == 0) ? 2 : 1;
+        
+        string first;
+        first.swap(stream->carry);
+        _feedTraceStream(stream, first.data(), first.size());
+        return;
+    }
+    
+    if(stream->kind == 1)
+    {
+        // finish the line split from the last chunk
+        if(!stream->carry.empty())
+        {
+            const char *lineEnd = (const char *)memchr(pos, '\n', end - pos);
+            
+            if(lineEnd == NULL)
+            {
+                stream->carry.append(pos, end - pos);
+                return;
+            }
+            
+            stream->carry.append(pos, lineEnd - pos);
+            _runTextLine(stream->carry.data(), stream->carry.data() + stream->carry.size());
+            stream->carry.clear();
+            pos = lineEnd + 1;
+        }
+        
+        while(pos < end)
+        {
+            const char *lineEnd = (const char *)memchr(pos, '\n', end - pos);
+            
+            if(lineEnd == NULL)
+            {
+                stream->carry.assign(pos, end - pos);
+                return;
+            }
+            
+            _runTextLine(pos, lineEnd);
+            pos = lineEnd + 1;
+        }
+        
+        return;
+    }
+    
+    // binary trace, the header and then the records, any of them may be split between chunks
+    while(pos < end)
+    {
+        size_t need = stream->has_header ? sizeof(trace_record) : sizeof(trace_header);
+        const char *item;
+        
+        if(stream->carry.empty() && (size_t)(end - pos) >= need)
+        {
+            item = pos;
+            pos += need;
+        }
+        else
+        {
+            size_t take = need - stream->carry.size();
+            
+            if(take > (size_t)(end - pos)) take = end - pos;
+            
+            stream->carry.append(pos, take);
+            pos += take;
+            
+            if(stream->carry.size() < need) return;
+            
+            item = stream->carry.data();
+        }
+        
+        if(!stream->has_header)
+        {
+            trace_header header;
+            
+            memcpy(&header, item, sizeof(header));
+            _checkTraceHeader(&header);
+            stream->has_header = 1;
+        }
+        else
+        {
+            trace_record record;
+            command cmd;
+            
+            memcpy(&record, item, sizeof(record));
+            _checkParseError(_recordToCommand(&record, &cmd));
+            _outputCommand(&cmd);
+            runCommand(&cmd);
+        }
+        
+        stream->carry.clear();
+    }
+}
+
+void Simulator::_finishTraceStream(trace_stream *stream)
+{
+    // a short trace has not been told apart yet
+    if(stream->kind == 0)
+    {
+        stream->kind = 1;
+        
+        string first;
+        first.swap(stream->carry);
+        _feedTraceStream(stream, first.data(), first.size());
+    }
+    
+    if(stream->carry.empty()) return;
+    
+    if(stream->kind == 1)
+    {
+        // the last line has no '\n'
+        _runTextLine(stream->carry.data(), stream->carry.data() + stream->carry.size());
+    }
+    else
+    {
+        cout << "_finishTraceStream::Binary trace is truncated, invalid input!" << endl;
+        exit(1);
+    }
+}
+
+void _convertTextTrace(const char *fileName)
+{
+    string strLine;
+    command cmd;
+    trace_record record;
+    trace_header header;
+    bool isConfig = 1;
+    
+    FILE *file = fopen(fileName, "wb");
+    
+    if(file == NULL)
+    {
+        cout << "_convertTextTrace::Can not open " << fileName << "!" << endl;
+        exit(1);
+    }
+    
+    memcpy(header.magic, TRACE_MAGIC, 4);
+    header.version = TRACE_VERSION;
+    header.config_records = 0;
+    header.record_size = sizeof(trace_record);
+    
+    // the header is written again at the end with the number of configuration records
+    fwrite(&header, sizeof(header), 1, file);
+    
+    while(getline(cin, strLine))
+    {
+        const char *end = strLine.c_str() + strLine.size();
+        const char *line = _skipSpaces(strLine.c_str(), end);
+        
+        if(line == end || *line == '#') continue;
+        
+        _checkParseError(_parseCommand(line, end, &cmd));
+        
+        if(cmd.type == NUMBER_OF_COMMANDS)
+        {
+            cout << strLine << endl << "Not found expected function, skip it!" << endl;
+            continue;
+        }
+        
+        if(cmd.type == CMD_READ || cmd.type == CMD_WRITE)
+        {
+            isConfig = 0;
+        }
+        else if(isConfig)
+        {
+            header.config_records++;
+        }
+        
+        _commandToRecord(&cmd, &record);
+        fwrite(&record, sizeof(record), 1, file);
+    }
+    
+    fseek(file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, file);
+    
+    if(ferror(file) || fclose(file) != 0)
+    {
+        cout << "_convertTextTrace::Failed to write " << fileName << "!" << endl;
+        exit(1);
+    }
+}
+
+void _commandToRecord(const command *cmd, trace_record *record)
+{
+    memset(record, 0, sizeof(trace_record));
+    
+    record->type = cmd->type;
+    record->chip_id = cmd->chip_id;
+    
+    switch(cmd->type)
+    {
+        case CMD_MEMORY_SIZE:
+        case CMD_CACHE_LINE_SIZE:
+        case CMD_CACHE_SIZE:
+            record->unit = cmd->size.unit;
+            record->data = cmd->size.data;
+            break;
+        
+        case CMD_NUM_OF_CHIPS:
+        case CMD_NUM_OF_CORES:
+        case CMD_CACHE_ASSOCIATIVITY:
+            record->number = cmd->number;
+            break;
+        
+        case CMD_CACHE_ACCESS_SPEED:
+        case CMD_REPLACEMENT_SPEED:
+        case CMD_BROADCAST_SPEED:
+        case CMD_MEMORY_ACCESS_SPEED:
+            record->unit = cmd->time.unit;
+            record->data = cmd->time.data;
+            break;
+        
+        default:
+            record->number = cmd->number;
+            record->address = cmd->address;
+            record->unit = cmd->size.unit;
+            record->data = cmd->size.data;
+            break;
+    }
+}
+
+const char *_recordToCommand(const trace_record *record, command *cmd)
+{
+    if(record->type >= NUMBER_OF_COMMANDS || record->unit > GB)
+    {
+        return "_recordToCommand::Unknown command in binary trace, invalid input!";
+    }
+    
+    cmd->type = (command_type)record->type;
+    cmd->chip_id = record->chip_id;
+    cmd->number = record->number;
+    cmd->address = record->address;
+    cmd->size.data = record->data;
+    cmd->size.unit = (unit_size)record->unit;
+    cmd->time.data = record->data;
+    cmd->time.unit = (unit_time)(record->unit & 1);
+    
+    return NULL;
+}
+
+void _recordCommand(sweep_trace *trace, const command *cmd)
+{
+    if(cmd->type != CMD_READ && cmd->type != CMD_WRITE)
+    {
+        // configuration commands are few, so they are kept as they are
+        if(trace->config_length == trace->config_capacity)
+        {
+            trace->config_capacity = trace->config_capacity * 2 + 16;
+            trace->config = (command *)realloc(trace->config, sizeof(command) * trace->config_capacity);
+            trace->config_at = (unsigned long *)realloc(trace->config_at, sizeof(unsigned long) * trace->config_capacity);
+        }
+        
+        trace->config[trace->config_length] = *cmd;
+        trace->config_at[trace->config_length] = trace->access_length;
+        trace->config_length++;
+        return;
+    }
+    
+    if(cmd->size.data > UINT32_MAX || cmd->number < 0 || cmd->number > UINT8_MAX || cmd->chip_id > INT16_MAX)
+    {
+        cout << "_recordCommand::Size, chip ID or core ID is too big for a sweep, invalid input!" << endl;
+        exit(1);
+    }
+    
+    if(trace->access_length == trace->access_capacity)
+    {
+        trace->access_capacity = trace->access_capacity * 2 + 4096;
+        trace->accesses = (sweep_access *)realloc(trace->accesses, sizeof(sweep_access) * trace->access_capacity);
+    }
+    
+    sweep_access *access = &trace->accesses[trace->access_length++];
+    
+    access->address = cmd->address;
+    access->size = cmd->size.data;
+    access->chip_id = cmd->chip_id;
+    access->core_id = cmd->number;
+    access->flags = (cmd->type == CMD_WRITE) | (cmd->size.unit << 1);
+}
+
+void _freeSweepTrace(sweep_trace *trace)
+{
+    free(trace->config);
+    free(trace->config_at);
+    free(trace->accesses);
+}
+
+void _parseSweepParameter(sweep_parameter *parameter, const char *spec)
+{
+    const char *equal = strchr(spec, '=');
+    
+    if(equal == NULL)
+    {
+        cout << "_parseSweepParameter::Not found expected \"name=value,...\" in " << spec << ", invalid input!" << endl;
+        exit(1);
+    }
+    
+    string name(spec, equal - spec);
+    
+    parameter->name = strdup(name.c_str());
+    parameter->is_l3 = name.size() > 2 && name.compare(name.size() - 2, 2, "L3") == 0;
+    
+    if(parameter->is_l3)
+    {
+        name.erase(name.size() - 2);
+    }
+    
+    // only the configuration commands can be changed, L3 only for the caches of each chip
+    int type = 0;
+    
+    while(type < CMD_READ && funcNames[type] != name) {type++;};
+    
+    if(type == CMD_READ || (parameter->is_l3 && type != CMD_CACHE_SIZE && type != CMD_CACHE_ASSOCIATIVITY && type != CMD_CACHE_ACCESS_SPEED))
+    {
+        cout << "_parseSweepParameter::Not found expected configuration command " << parameter->name << ", invalid input!" << endl;
+        exit(1);
+    }
+    
+    parameter->type = (command_type)type;
+    parameter->length = 1;
+    
+    for(const char *pos = equal + 1; *pos; pos++)
+    {
+        if(*pos == ',') parameter->length++;
+    }
+    
+    parameter->values = new command[parameter->length];
+    parameter->texts = new string[parameter->length];
+    
+    const char *start = equal + 1;
+    
+    for(int i=0; i<parameter->length; i++)
+    {
+        const char *end = strchr(start, ',');
+        
+        if(end == NULL) end = start + strlen(start);
+        
+        command *value = &parameter->values[i];
+        
+        value->type = parameter->type;
+        parameter->texts[i] = string(start, end - start);
+        
+        switch(parameter->type)
+        {
+            case CMD_MEMORY_SIZE:
+            case CMD_CACHE_LINE_SIZE:
+            case CMD_CACHE_SIZE:
+                _checkParseError(_getSize(start, end, &value->size));
+                break;
+            
+            case CMD_NUM_OF_CHIPS:
+            case CMD_NUM_OF_CORES:
+            case CMD_CACHE_ASSOCIATIVITY:
+                _checkParseError(_getNumber(start, end, &value->number));
+                break;
+            
+            default:
+                _checkParseError(_getTime(start, end, &value->time));
+                break;
+        }
+        
+        start = end + 1;
+    }
+}
+
+void _freeSweepParameter(sweep_parameter *parameter)
+{
+    free((char *)parameter->name);
+    delete[] parameter->values;
+    delete[] parameter->texts;
+}
+
+void _runSweep(const sweep_trace *trace, const sweep_parameter parameters[], int count, int threads)
+{
+    // every combination of values is one point of the grid
+    unsigned long points = 1;
+    bool isMultiChip = 0;
+    
+    for(int i=0; i<trace->config_length; i++)
+    {
+        isMultiChip |= trace->config[i].type == CMD_NUM_OF_CHIPS && trace->config[i].number > 1;
+    }
+    
+    for(int i=0; i<count; i++)
+    {
+        // a value replaces the argument of a command in the trace, so the command must be there
+        int j = 0;
+        
+        while(j < trace->config_length && (trace->config[j].type != parameters[i].type || 
+              ((parameters[i].type == CMD_CACHE_SIZE || parameters[i].type == CMD_CACHE_ASSOCIATIVITY || parameters[i].type == CMD_CACHE_ACCESS_SPEED) &&
+               parameters[i].is_l3 != (trace->config[j].chip_id == -1 && isMultiChip)))) {j++;};
+        
+        if(j == trace->config_length)
+        {
+            cout << "_runSweep::Not found " << parameters[i].name << " in the trace to sweep, invalid input!" << endl;
+            exit(1);
+        }
+        
+        points *= parameters[i].length;
+    }
+    
+    if(threads < 1)
+    {
+        threads = thread::hardware_concurrency();
+    }
+    
+    if(threads < 1 || (unsigned long)threads > points)
+    {
+        threads = threads < 1 ? 1 : points;
+    }
+    
+    core_stats *results = new core_stats[points]();
+    atomic<unsigned long> next(0);
+    thread *workers = new thread[threads];
+    
+    for(int i=0; i<threads; i++)
+    {
+        workers[i] = thread(_sweepWorker, trace, parameters, count, &next, points, results);
+    }
+    
+    for(int i=0; i<threads; i++)
+    {
+        workers[i].join();
+    }
+    
+    // one row for each point, the first parameter changes slowest
+    for(int i=0; i<count; i++)
+    {
+        fputs(parameters[i].name, stdout);
+        putchar(',');
+    }
+    
+    fputs("reads,writes", stdout);
+    
+    for(int i=0; i<NUMBER_OF_OPTS; i++)
+    {
+        putchar(',');
+        fputs(OptTypeNames[i], stdout);
+    }
+    
+    fputs(",time_ns\n", stdout);
+    
+    for(unsigned long point=0; point<points; point++)
+    {
+        unsigned long rest = point;
+        int values[SWEEP_MAX_PARAMETERS];
+        
+        for(int i=count-1; i>=0; i--)
+        {
+            values[i] = rest % parameters[i].length;
+            rest /= parameters[i].length;
+        }
+        
+        for(int i=0; i<count; i++)
+        {
+            fputs(parameters[i].texts[values[i]].c_str(), stdout);
+            putchar(',');
+        }
+        
+        _writeNumber(stdout, results[point].reads);
+        putchar(',');
+        _writeNumber(stdout, results[point].writes);
+        
+        for(int i=0; i<NUMBER_OF_OPTS; i++)
+        {
+            putchar(',');
+            _writeNumber(stdout, results[point].counts[i]);
+        }
+        
+        putchar(',');
+        _writeNumber(stdout, results[point].time);
+        putchar('\n');
+    }
+    
+    delete[] workers;
+    delete[] results;
+}
+
+void _sweepWorker(const sweep_trace *trace, const sweep_parameter parameters[], int count, atomic<unsigned long> *next, unsigned long points, core_stats results[])
+{
+    unsigned long point;
+    
+    while((point = next->fetch_add(1)) < points)
+    {
+        _runSweepPoint(trace, parameters, count, point, &results[point]);
+    }
+}
+
+void _runSweepPoint(const sweep_trace *trace, const sweep_parameter parameters[], int count, unsigned long point, core_stats *result)
+{
+    Simulator simulator;
+    sweep_state state;
+    int values[SWEEP_MAX_PARAMETERS];
+    bool isChipsSwept = 0;
+    bool isCoresSwept = 0;
+    
+    // the value of each parameter at this point
+    for(int i=count-1; i>=0; i--)
+    {
+        values[i] = point % parameters[i].length;
+        point /= parameters[i].length;
+        
+        isChipsSwept |= parameters[i].type == CMD_NUM_OF_CHIPS;
+        isCoresSwept |= parameters[i].type == CMD_NUM_OF_CORES;
+    }
+    
+    state.trace_chips = 1;
+    state.chips = 1;
+    state.cores = new int[1]();
+    
+    // only the summary is kept, messages of each configuration are not printed
+    simulator.quiet_output = 1;
+    simulator.output = NULL;
+    
+    int index = 0;
+    
+    for(unsigned long i=0; i<=trace->access_length; i++)
+    {
+        while(index < trace->config_length && trace->config_at[index] == i)
+        {
+            _runSweepConfig(&simulator, &trace->config[index++], parameters, count, values, &state);
+        }
+        
+        if(i == trace->access_length) break;
+        
+        const sweep_access *access = &trace->accesses[i];
+        command cmd;
+        
+        cmd.type = (access->flags & 1) ? CMD_WRITE : CMD_READ;
+        cmd.chip_id = access->chip_id;
+        cmd.number = access->core_id;
+        cmd.address = access->address;
+        cmd.size.data = access->size;
+        cmd.size.unit = (unit_size)(access->flags >> 1);
+        
+        // a trace for more chips or cores spreads its accesses over the ones in this configuration
+        if(isChipsSwept && cmd.chip_id >= 0)
+        {
+            cmd.chip_id %= state.chips;
+        }
+        
+        int chipID = cmd.chip_id < 0 ? 0 : cmd.chip_id;
+        
+        if(isCoresSwept && chipID < state.chips && state.cores[chipID] > 0)
+        {
+            cmd.number %= state.cores[chipID];
+        }
+        
+        simulator.runCommand(&cmd);
+    }
+    
+    simulator.getStats(-1, -1, result);
+    delete[] state.cores;
+}
+
+void _runSweepConfig(Simulator *simulator, const command *cmd, const sweep_parameter parameters[], int count, const int values[], sweep_state *state)
+{
+    command current = *cmd;
+    
+    for(int i=0; i<count; i++)
+    {
+        const command *value = &parameters[i].values[values[i]];
+        
+        if(parameters[i].type != current.type) continue;
+        
+        // a command without chip ID is for cache L3 when there are multiple chips
+        if(current.type == CMD_CACHE_SIZE || current.type == CMD_CACHE_ASSOCIATIVITY || current.type == CMD_CACHE_ACCESS_SPEED)
+        {
+            if(parameters[i].is_l3 != (current.chip_id == -1 && state->chips > 1)) continue;
+        }
+        
+        current.size = value->size;
+        current.time = value->time;
+        current.number = value->number;
+    }
+    
+    if(current.type == CMD_NUM_OF_CHIPS)
+    {
+        // chips can only be added or removed when the trace sets up L3 for multiple chips
+        if(current.number != cmd->number && (cmd->number < 2 || current.number < 2))
+        {
+            cout << "_runSweepConfig::numOfChips can only be swept for a trace of multiple chips, invalid input!" << endl;
+            exit(1);
+        }
+        
+        state->trace_chips = cmd->number;
+        state->chips = current.number;
+        
+        delete[] state->cores;
+        state->cores = new int[state->chips]();
+    }
+    
+    // chips not in this configuration are skipped, chips not in the trace are set up like chip 0
+    if(current.chip_id >= state->chips) return;
+    
+    int copies = (cmd->chip_id == 0 && state->chips > state->trace_chips) ? state->chips - state->trace_chips : 0;
+    
+    for(int i=0; i<=copies; i++)
+    {
+        current.chip_id = (i == 0) ? cmd->chip_id : state->trace_chips + i - 1;
+        simulator->runCommand(&current);
+        
+        if(current.type == CMD_NUM_OF_CORES)
+        {
+            for(int j=0; j<state->chips; j++)
+            {
+                if(current.chip_id == -1 || j == current.chip_id) state->cores[j] = current.number;
+            }
+        }
+    }
+}
+
+void Simulator::memorySize(obj_size size)
+{
+     memory_size = size;
+     //cout << "Memory Size=" << memory_size.data << UnitSizeNames[memory_size.unit] << endl;
+}
+
+void Simulator::numOfChips(int number)
+{
+     _freeChips();
+     number_of_chips = number;
+     
+     // initialize array_chips as expected number
+     array_chips = new chip[number_of_chips]();
+     
+     //cout << "Total Chips=" << number_of_chips << endl;
+}
+
+void Simulator::numOfCores(int chipID, int number)
+{
+     // if only one chip, initialize array_chips as 1, keep the caches already set
+     if(array_chips == NULL) 
+     {
+         array_chips = new chip[1]();               
+     }
+
+     // if chipID=-1, means no chipID from input, then all chips have the same number of cores
+     // if chipID!=-1, set specified core number for that chip 
+     for(int i=0; i<number_of_chips; i++) 
+     {
+         if(chipID != -1 && i != chipID) continue;
+         
+         array_chips[i].number_of_core = number;
+         
+         // L2 is already set, the memo needs one entry for each core
+         if(array_chips[i].memo_page != NULL)
+         {
+             _initMemoL2(&array_chips[i]);
+         }
+     }
+     
+     // print chip id and core number
+     //for(int i=0; i<number_of_chips; i++) 
+//     {
+//         cout << "Chip " << i << ": " << array_chips[i].number_of_core << " cores" << endl;
+//     }
+}
+
+void Simulator::cacheLineSize(obj_size size)
+{
+      cache_line_size = size;
+      
+      // caculate the total memory pages
+      memory_pages = _caculateTotalBlocks(memory_size);
+       
+      //cout<< "Total Memory Pages=" << memory_pages << endl; 
+}
+
+void Simulator::cacheSize(int chipID, obj_size size)
+{
+     // if chipID=-1, means no chipID from input
+     // if chipID!=-1, set specified number for that chip 
+     if(chipID == -1) 
+     {
+         if(number_of_chips > 1)
+         {
+             cache_size_l3 = size;
+             total_block_l3 = _caculateTotalBlocks(size);
+             
+             // release L3 of an earlier cacheSize
+             delete[] tlb_l3;
+             _freePageIndex(index_l3);
+             _freeLRUList(lru_l3);
+             _freeBlockBitmap(bitmap_l3);
+             
+             // construct and initialize TLB for L3, all lines are invalid
+             tlb_l3 = new unsigned long long[total_block_l3];
+             
+             for(int i=0; i<total_block_l3; i++) 
+             {
+                 tlb_l3[i] = 0;
+             }
+             
+             // fully associative until cacheAssociativity splits it into sets
+             number_of_ways_l3 = total_block_l3;
+             number_of_sets_l3 = 1;
+             
+             _initPageIndex(index_l3, total_block_l3);
+             _initLRUList(lru_l3, total_block_l3, 1);
+             _initBlockBitmap(bitmap_l3, total_block_l3, 1);
+             
+             _outputString("L3=");
+             _outputNumber(cache_size_l3.data);
+             _outputString(UnitSizeNames[cache_size_l3.unit]);
+             _outputString("\nTotal L3 Blocks=");
+             _outputNumber(total_block_l3);
+             _outputChar('\n');
+             return;                  
+         }
+         else
+         {
+             chipID = 0;
+         }
+     } 
+    
+     // initialize L2 of current chip, keep the number of cores set before
+     chip *currentChip = &array_chips[chipID];
+     
+     currentChip->cache_size_l2 = size;
+     currentChip->total_block_l2 = _caculateTotalBlocks(size);
+     
+     // release L2 of an earlier cacheSize, the memo is released by _initMemoL2
+     delete[] currentChip->tlb_l2;
+     _freePageIndex(&currentChip->index_l2);
+     _freeLRUList(&currentChip->lru_l2);
+     _freeBlockBitmap(&currentChip->bitmap_l2);
+     
+     // construct and initialize TLB for L2, all lines are invalid
+     int length = currentChip->total_block_l2;
+     currentChip->tlb_l2 = new unsigned long long[length];
+         
+     for(int i=0; i<length; i++) 
+     {
+         currentChip->tlb_l2[i] = 0;
+     } 
+     
+     // fully associative until cacheAssociativity splits it into sets
+     currentChip->number_of_ways_l2 = length;
+     currentChip->number_of_sets_l2 = 1;
+     
+     _initPageIndex(&currentChip->index_l2, length);
+     _initLRUList(&currentChip->lru_l2, length, 1);
+     _initBlockBitmap(&currentChip->bitmap_l2, length, 1);
+     
+     _initMemoL2(currentChip);
+     
+     // print chip info
+    
+     //cout << "Chip " << chipID << ", L2=" << array_chips[chipID].cache_size_l2.data
+     //<< UnitSizeNames[array_chips[chipID].cache_size_l2.unit] 
+     //<< ", Total L2 Blocks=" << array_chips[chipID].total_block_l2 << endl;
+}
+
+void Simulator::cacheAssociativity(int chipID, int number)
+{
+     // if chipID=-1, means no chipID from input
+     // if chipID!=-1, set specified number for that chip 
+     if(chipID == -1) 
+     {
+         if(number_of_chips > 1)
+         {
+             number_of_ways_l3 = number;
+             number_of_sets_l3 = total_block_l3 / number;
+             
+             // rebuild LRU order for each set, only a fully associative cache needs the page index
+             _freeLRUList(lru_l3);
+             _initLRUList(lru_l3, total_block_l3, number_of_sets_l3);
+             _freeBlockBitmap(bitmap_l3);
+             _initBlockBitmap(bitmap_l3, total_block_l3, number_of_sets_l3);
+             _freePageIndex(index_l3);
+             
+             if(number_of_sets_l3 == 1)
+             {
+                 _initPageIndex(index_l3, total_block_l3);
+             }
+             
+             _outputString("L3 Associativity=");
+             _outputNumber(number_of_ways_l3);
+             _outputString(", Total L3 Sets=");
+             _outputNumber(number_of_sets_l3);
+             _outputChar('\n');
+             return;                  
+         }
+         else
+         {
+              chipID = 0;
+         }
+     } 
+     
+     chip *currentChip = &array_chips[chipID];
+     
+     currentChip->number_of_ways_l2 = number;
+     currentChip->number_of_sets_l2 = currentChip->total_block_l2 / number;
+     
+     _freeLRUList(&currentChip->lru_l2);
+     _initLRUList(&currentChip->lru_l2, currentChip->total_block_l2, currentChip->number_of_sets_l2);
+     _freeBlockBitmap(&currentChip->bitmap_l2);
+     _initBlockBitmap(&currentChip->bitmap_l2, currentChip->total_block_l2, currentChip->number_of_sets_l2);
+     _freePageIndex(&currentChip->index_l2);
+     
+     if(currentChip->number_of_sets_l2 == 1)
+     {
+         _initPageIndex(&currentChip->index_l2, currentChip->total_block_l2);
+     }
+}
+
+void Simulator::cacheAccessSpeed(int chipID, obj_time time)
+{
+     // if chipID=-1, means no chipID from input
+     // if chipID!=-1, set specified number for that chip 
+     if(chipID == -1) 
+     {
+         if(number_of_chips > 1)
+         {
+             cache_access_speed_l3 = time;
+             
+             _outputString("L3 Access Speed=");
+             _outputNumber(cache_access_speed_l3.data);
+             _outputString(UnitTimeNames[cache_access_speed_l3.unit]);
+             _outputChar('\n');
+             return;                  
+         }
+         else
+         {
+              chipID = 0;
+         }
+     } 
+    
+     array_chips[chipID].cache_access_speed_l2= time;
+     
+     // print chip info
+     //cout << "Chip " << chipID << ", L2 Access Speed=" << array_chips[chipID].cache_access_speed_l2.data 
+     //<< UnitTimeNames[array_chips[chipID].cache_access_speed_l2.unit] << endl;
+}
+
+void Simulator::replacementSpeed(obj_time time)
+{
+     replacement_speed = time;
+     
+     //cout << "Replacement Speed=" << replacement_speed.data << UnitTimeNames[replacement_speed.unit] << endl;
+}
+
+void Simulator::broadcastSpeed(obj_time time)
+{
+     broadcast_speed = time;
+     
+     //cout << "Broadcast Speed=" << broadcast_speed.data << UnitTimeNames[broadcast_speed.unit] << endl;
+}
+
+void Simulator::memoryAccessSpeed(obj_time time)
+{
+     memory_access_speed = time;
+     
+     //cout << "Memory Access Speed=" << memory_access_speed.data << UnitTimeNames[memory_access_speed.unit] << endl;
+}
+
+void Simulator::read(int chipID, int coreID, string address, obj_size size)
+{
+    _checkParseError(_readAddress(chipID, coreID, strtoul(address.c_str(), NULL, 16), size));
+}
+
+const char *Simulator::_readAddress(int chipID, int coreID, unsigned long address, obj_size size)
+{
+    PROFILE_SCOPE(PROFILE_ACCESS);
+    
+    if(stack_analysis)
+    {
+        return _analyzeAccess(chipID, coreID, address, size, 0);
+    }
+    
+    if(shard_threads > 0 && (shards != NULL || _startShards()))
+    {
+        return _shardAccess(chipID, coreID, address, size, 0);
+    }
+    
+    if(chip_threads && (stages != NULL || _startStages()))
+    {
+        return _stageAccess(chipID, coreID, address, size, 0);
+    }
+    
+   // if(chipID == -1)
+//    {
+//        cout << "coreID=" << coreID 
+//        << ",address=" << address << ",size=" << size.data << UnitSizeNames[size.unit] << endl;      
+//    }
+//    else
+//    {
+//        cout << "chipID=" << chipID << ",coreID=" << coreID 
+//        << ",address=" << address << ",size=" << size.data << UnitSizeNames[size.unit] << endl;
+//    }
+    
+    unsigned long loadingPage = address/cache_line_size.data;
+    
+    if(loadingPage > memory_pages)
+    {
+        _outputString("Invalid address, out of memory pages range, ignore this command!\n");
+        return NULL;               
+    }
+    
+    int loadingPageSize = _caculateNeedBlocks(address, size);
+    
+    if(!quiet_output)
+    {
+        _outputString("loading page is ");
+        _outputNumber(loadingPage);
+        _outputString(",page size is ");
+        _outputNumber(loadingPageSize);
+        _outputChar('\n');
+    }
+    
+    if(chipID == -1) 
+    {
+        chipID = 0;           
+    }
+    
+    const char *error = _checkValidIDs(chipID, coreID);
+    
+    if(error != NULL)
+    {
+        return error;
+    }
+    
+    for(int i=0; i<loadingPageSize; i++, loadingPage++) 
+    {  
+       // a repeated hit by the same core is counted by the memo alone
+       if(_hitMemoL2(chipID, coreID, loadingPage, 0) != -1)
+       {
+           continue;
+       }
+       
+       int isExisting = _checkCacheL2(chipID, loadingPage, 1);
+       
+       // if not -1, find it in L2, read it
+       if(isExisting != -1)
+       {
+           _readFromCacheL2(chipID, coreID, isExisting);   
+       }
+       else
+       {
+           // not in L2 ,try L3
+           if(number_of_chips > 1)
+           {
+               isExisting = _checkCacheL3(chipID, loadingPage, 1);
+               
+               // if not -1, find it in L3
+               if(isExisting != -1)
+               {
+                   _readFromCacheL3(chipID, coreID, isExisting);
+               }
+               else
+               {
+                   // load from memory and write L2
+                   _loadMemToCacheL2(chipID, coreID, loadingPage);
+                   
+                   // write L3
+                   _writeToCacheL3(chipID, coreID, loadingPage, 1);
+               }
+           }
+           else
+           {
+               // load from memory and write L2
+               _loadMemToCacheL2(chipID, coreID, loadingPage);
+           }
+       }    
+    }
+    
+    _collectStats(chipID, coreID, 0);
+    
+    if(export_file != NULL)
+    {
+        _exportAccess(chipID, coreID, 0, address, address/cache_line_size.data, loadingPageSize);
+    }
+    
+    if(!quiet_output)
+    {
+        _printResult();
+    }
+    
+    _clearResult();
+    
+    // the summary so far, every stats_interval reads and writes
+    if(stats_interval > 0 && stats_accesses % stats_interval == 0)
+    {
+        printStats();
+    }
+    
+    return NULL;
+}
+
+void Simulator::write(int chipID, int coreID, string address, obj_size size)
+{
+    _checkParseError(_writeAddress(chipID, coreID, strtoul(address.c_str(), NULL, 16), size));
+}
+
+const char *Simulator::_writeAddress(int chipID, int coreID, unsigned long address, obj_size size)
+{
+    PROFILE_SCOPE(PROFILE_ACCESS);
+    
+    if(stack_analysis)
+    {
+        return _analyzeAccess(chipID, coreID, address, size, 1);
+    }
+    
+    if(shard_threads > 0 && (shards != NULL || _startShards()))
+    {
+        return _shardAccess(chipID, coreID, address, size, 1);
+    }
+    
+    if(chip_threads && (stages != NULL || _startStages()))
+    {
+        return _stageAccess(chipID, coreID, address, size, 1);
+    }
+    
+    //cout << "write test enter" << endl;
+    
+    //if(chipID == -1)
+//    {
+//        cout << "coreID=" << coreID 
+//        << ",address=" << address << ",size=" << size.data << UnitSizeNames[size.unit] << endl;      
+//    }
+//    else
+//    {
+//        cout << "chipID=" << chipID << ",coreID=" << coreID 
+//        << ",address=" << address << ",size=" << size.data << UnitSizeNames[size.unit] << endl;
+//    }
+    
+    unsigned long loadingPage = address/cache_line_size.data;
+    
+    if(loadingPage > memory_pages)
+    {
+        _outputString("Invalid address, out of memory pages range, ignore this command!\n\n");
+        return NULL;               
+    }
+    
+    int loadingPageSize = _caculateNeedBlocks(address, size);
+    
+    if(!quiet_output)
+    {
+        _outputString("loading page is ");
+        _outputNumber(loadingPage);
+        _outputString(",page size is ");
+        _outputNumber(loadingPageSize);
+        _outputChar('\n');
+    }
+     
+    if(chipID == -1) 
+    {
+        chipID = 0;           
+    }
+    
+    const char *error = _checkValidIDs(chipID, coreID);
+    
+    if(error != NULL)
+    {
+        return error;
+    }
+    
+    for(int i=0; i<loadingPageSize; i++, loadingPage++) 
+    {
+       // a repeated hit by the same core is counted by the memo alone, L3 still sees the write
+       int isMemo = _hitMemoL2(chipID, coreID, loadingPage, 1);
+       int isExisting = isMemo != -1 ? isMemo : _checkCacheL2(chipID, loadingPage, 1);
+       
+       if(isExisting != -1)
+       {
+           // rewrite L2
+           if(isMemo == -1)
+           {
+               _rewriteToCacheL2(chipID, coreID, isExisting);
+           }
+           
+           if(number_of_chips > 1)
+           {
+               isExisting = _checkCacheL3(chipID, loadingPage, 0);
+               
+               if(isExisting != -1)
+               {
+                   // rewrite L3 and mark other L2 as invalid
+                   _rewriteToCacheL3(chipID, coreID, isExisting, loadingPage);
+               }
+               else
+               {
+                   // it has been replaced in L3, write L3 again
+                   _writeToCacheL3(chipID, coreID, loadingPage, 0);
+               }
+           }
+       }
+       else
+       {
+           // write L2
+           _writeToCacheL2(chipID, coreID, loadingPage);
+           
+           if(number_of_chips > 1)
+           {
+               isExisting = _checkCacheL3(chipID, loadingPage, 1);
+               
+               if(isExisting != -1)
+               {
+                   // if exist in L3, rewrite L3 and mark other L2 as invalid
+                   _rewriteToCacheL3(chipID, coreID, isExisting, loadingPage); 
+               }
+               else
+               {
+                   // if not exist, write L3
+                   _writeToCacheL3(chipID, coreID, loadingPage, 0);
+               }   
+           }
+       }    
+    }
+        
+    _collectStats(chipID, coreID, 1);
+    
+    if(export_file != NULL)
+    {
+        _exportAccess(chipID, coreID, 1, address, address/cache_line_size.data, loadingPageSize);
+    }
+    
+    if(!quiet_output)
+    {
+        _printResult();
+    }
+    
+    _clearResult();
+    
+    // the summary so far, every stats_interval reads and writes
+    if(stats_interval > 0 && stats_accesses % stats_interval == 0)
+    {
+        printStats();
+    }
+    
+    return NULL;
+}
+
+const char *_skipSpaces(const char *str, const char *end)
+{
+    while(str < end && isspace((unsigned char)*str)) {str++;};
+    
+    return str;
+}
+
+const char *_parseCommand(const char *line, const char *end, command *cmd)
+{
+    PROFILE_SCOPE(PROFILE_PARSE);
+    
+    const char *starts[4]; // start of each argument
+    const char *ends[4]; // end of each argument, trailing space removed
+    const char *error = NULL;
+    int count = 0;
+    const char *pos = line;
+    
+    // get the function name, it is letters only
+    while(pos < end && isalpha((unsigned char)*pos)) {pos++;};
+    
+    int nameLength = pos - line;
+    
+    pos = _skipSpaces(pos, end);
+    
+    if(pos == end || *pos != '(')
+    {
+        if(pos == end || *pos == '#')
+        {
+            return "_parseCommand::Not found expected '(', invalid input!";
+        }
+        
+        return "_parseCommand::Invalid function name!";
+    }
+    
+    // split the arguments by ',' until ')'
+    while(1)
+    {
+        pos = _skipSpaces(pos+1, end);
+        
+        if(count == 4)
+        {
+            return "_parseCommand::Too many arguments, invalid input!";
+        }
+        
+        starts[count] = pos;
+        
+        while(pos < end && *pos != ',' && *pos != ')') {pos++;};
+        
+        ends[count] = pos;
+        while(ends[count] > starts[count] && isspace((unsigned char)ends[count][-1])) {ends[count]--;};
+        count++;
+        
+        if(pos == end)
+        {
+            return "_parseCommand::Not found expected ')', invalid input!";
+        }
+        
+        if(*pos == ')') break;
+    }
+    
+    // only white space or a comment is allowed after ')'
+    pos = _skipSpaces(pos+1, end);
+    
+    if(pos != end && *pos != '#')
+    {
+        return "_parseCommand::Unexpected characters after ')', invalid input!";
+    }
+    
+    // match the function name, NUMBER_OF_COMMANDS if not found
+    int type = 0;
+    
+    while(type < NUMBER_OF_COMMANDS && funcNames[type].compare(0, string::npos, line, nameLength) != 0) {type++;};
+    
+    cmd->type = (command_type)type;
+    cmd->chip_id = -1;
+    
+    if(type == NUMBER_OF_COMMANDS) return NULL;
+    
+    // read and write have core ID, address and size, the others have one argument,
+    // and some of them take an optional chip ID before
+    int expected = (type == CMD_READ || type == CMD_WRITE) ? 3 : 1;
+    bool hasChipID = (type == CMD_NUM_OF_CORES || type == CMD_CACHE_SIZE || type == CMD_CACHE_ASSOCIATIVITY 
+                      || type == CMD_CACHE_ACCESS_SPEED || type == CMD_READ || type == CMD_WRITE);
+    int first = 0;
+    
+    if(hasChipID && count == expected+1)
+    {
+        error = _getNumber(starts[0], ends[0], &cmd->chip_id);
+        first = 1;
+    }
+    else if(count != expected)
+    {
+        return "_parseCommand::Wrong number of arguments, invalid input!";
+    }
+    
+    if(error != NULL) return error;
+    
+    switch(type)
+    {
+        case CMD_MEMORY_SIZE:
+        case CMD_CACHE_LINE_SIZE:
+        case CMD_CACHE_SIZE:
+            return _getSize(starts[first], ends[first], &cmd->size);
+        
+        case CMD_NUM_OF_CHIPS:
+        case CMD_NUM_OF_CORES:
+        case CMD_CACHE_ASSOCIATIVITY:
+            return _getNumber(starts[first], ends[first], &cmd->number);
+        
+        case CMD_CACHE_ACCESS_SPEED:
+        case CMD_REPLACEMENT_SPEED:
+        case CMD_BROADCAST_SPEED:
+        case CMD_MEMORY_ACCESS_SPEED:
+            return _getTime(starts[first], ends[first], &cmd->time);
+        
+        default:
+            if((error = _getNumber(starts[first], ends[first], &cmd->number)) != NULL) return error;
+            if((error = _getAddress(starts[first+1], ends[first+1], &cmd->address)) != NULL) return error;
+            return _getSize(starts[first+2], ends[first+2], &cmd->size);
+    }
+}
+
+void _checkParseError(const char *error)
+{
+    if(error != NULL)
+    {
+        cout << error << endl;
+        exit(1);
+    }
+}
+
+bool _scanDigits(const char **start, const char *end, unsigned long *data)
+{
+    const char *pos = *start;
+    
+    if(pos == end || !isdigit((unsigned char)*pos)) return 0;
+    
+    *data = 0;
+    
+    while(pos < end && isdigit((unsigned char)*pos)) 
+    {
+        *data = *data*10 + (*pos - '0');
+        pos++;
+    }
+    
+    *start = pos;
+    
+    return 1;
+}
+
+const char *_getSize(const char *start, const char *end, obj_size *size)
+{
+    PROFILE_SCOPE(PROFILE_GET);
+    
+    // get the number part
+    if(!_scanDigits(&start, end, &size->data))
+    {
+        return "_getSize::Not found expected number, invalid input!";
+    }
+    
+    // remove the space between number and unit
+    start = _skipSpaces(start, end);
+    
+    // get the unit part, like B, KB, MB, or GB
+    int unit = 0;
+    
+    while(unit <= GB && (strlen(UnitSizeNames[unit]) != (size_t)(end - start) 
+                         || strncmp(UnitSizeNames[unit], start, end - start) != 0)) {unit++;};
+    
+    if(unit > GB)
+    {
+        return "_getSize::Not found expected unit(B, KB, MB or GB), invalid input!";
+    }
+    
+    size->unit = (unit_size)unit;
+    
+    return NULL;
+}
+
+const char *_getTime(const char *start, const char *end, obj_time *time)
+{
+    PROFILE_SCOPE(PROFILE_GET);
+    
+    // get the number part
+    if(!_scanDigits(&start, end, &time->data))
+    {
+        return "_getTime::Not found expected number, invalid input!";
+    }
+    
+    // remove the space between number and unit
+    start = _skipSpaces(start, end);
+    
+    // get the unit part, like us, ns
+    if(end - start == 2 && strncmp(start, "us", 2) == 0) 
+    {
+       time->unit = us;     
+    } 
+    else if(end - start == 2 && strncmp(start, "ns", 2) == 0) 
+    {
+       time->unit = ns; 
+    } 
+    else 
+    {
+       return "_getTime::Not found expected unit(us, ns), invalid input!";
+    }
+    
+    return NULL;
+}
+
+const char *_getNumber(const char *start, const char *end, int *number)
+{
+    PROFILE_SCOPE(PROFILE_GET);
+    
+    unsigned long data;
+    
+    if(!_scanDigits(&start, end, &data))
+    {
+        return "_getNumber::Not found expected number, invalid input!";
+    }
+    
+    if(start != end) 
+    {
+       return "_getNumber::Not found expected ',' or ')', invalid input!";
+    }
+    
+    *number = data;
+    
+    return NULL;
+}
+
+const char *_getAddress(const char *start, const char *end, unsigned long *address)
+{
+    PROFILE_SCOPE(PROFILE_GET);
+    
+    unsigned long data = 0;
+    
+    // the address is hexadecimal, "0x" is optional
+    if(end - start > 2 && start[0] == '0' && (start[1] == 'x' || start[1] == 'X')) 
+    {
+        start += 2;
+    }
+    
+    if(start == end) 
+    {
+        return "_getAddress::Not found expected character, invalid input!";
+    }
+    
+    while(start < end) 
+    {
+        if(!isxdigit((unsigned char)*start)) 
+        {
+            return "_getAddress::Not found expected hexadecimal number, invalid input!";
+        }
+        
+        data = data*16 + (isdigit((unsigned char)*start) ? *start - '0' : (tolower((unsigned char)*start) - 'a' + 10));
+        start++;
+    }
+    
+    *address = data;
+    
+    return NULL;
+}
+
+unsigned long Simulator::_caculateTotalBlocks(obj_size size)
+{
+    // the sizes are checked to be at least one line by _checkCommand
+    int step = size.unit - cache_line_size.unit;
+    unsigned long total_block = (long)(size.data * pow(2,step*10)/cache_line_size.data);
+    
+    return total_block;
+}
+
+unsigned long Simulator::_caculateNeedBlocks(unsigned long address, obj_size size)
+{
+    unsigned long need_blocks;
+    
+    int modulo = address % cache_line_size.data;
+    
+    if(modulo != 0)
+    {
+        if(size.unit < cache_line_size.unit) 
+        {
+            need_blocks = 1;
+        }
+        else
+        {
+            int step = size.unit - cache_line_size.unit;
+            unsigned long temp1 = address / cache_line_size.data;
+            unsigned long temp2 = (long)((address + size.data * pow(2,step*10)) / cache_line_size.data);
+            need_blocks = temp2 - temp1 + 1; 
+        }                   
+    }
+    else 
+    {
+        if(size.unit < cache_line_size.unit) 
+        {
+            need_blocks = 1;
+        } 
+        else 
+        {
+            int step = size.unit - cache_line_size.unit;
+            need_blocks = (long)(size.data * pow(2,step*10)/cache_line_size.data);
+            modulo = (long)(size.data * pow(2,step*10))%cache_line_size.data;
+            
+            if(modulo != 0)
+            {
+                need_blocks++;
+            }
+        }
+    }
+    
+    return need_blocks;
+}
+
+int Simulator::_checkCacheL2(int chipID, unsigned long loadingPage, bool isAddTime)
+{
+    PROFILE_SCOPE(PROFILE_CHECK_L2);
+    
+    int r = -1;
+    chip *currentChip = &array_chips[chipID];
+    
+    // a chip without L2 has no sets, every line misses
+    if(currentChip->number_of_sets_l2 == 1)
+    {
+        // only valid entries are kept in the index
+        r = _findPageInIndex(&currentChip->index_l2, loadingPage);
+    }
+    else if(currentChip->number_of_sets_l2 > 1)
+    {
+        // only compare the ways of the set it maps to, the valid bit is part of the tag
+        int first = (loadingPage % currentChip->number_of_sets_l2) * currentChip->number_of_ways_l2;
+        int way = _findTagInSet(currentChip->tlb_l2 + first, currentChip->number_of_ways_l2, LINE_VALID | loadingPage);
+        
+        if(way != -1)
+        {
+            r = first + way;
+        }
+    }
+    
+    if(isAddTime)
+    {
+        opt_type opt;
+        
+        if(r != -1)
+        {
+            opt = OPT_L2HIT;    
+        }
+        else
+        {
+            opt = OPT_L2MISS;
+        }
+        
+        _addResultTime(opt, currentChip->cache_access_speed_l2);
+    }
+        
+    return r;
+}
+
+int Simulator::_checkCacheL3(int chipID, unsigned long loadingPage, bool isAddTime)
+{
+    PROFILE_SCOPE(PROFILE_CHECK_L3);
+    
+    int r = -1;
+    
+    if(number_of_sets_l3 == 1)
+    {
+        r = _findPageInIndex(index_l3, loadingPage);
+    }
+    else
+    {
+        // only compare the ways of the set it maps to, the valid bit is part of the tag
+        int first = (loadingPage % number_of_sets_l3) * number_of_ways_l3;
+        int way = _findTagInSet(tlb_l3 + first, number_of_ways_l3, LINE_VALID | loadingPage);
+        
+        if(way != -1)
+        {
+            r = first + way;
+        }
+    }
+    
+    if(isAddTime)
+    {
+        opt_type opt;
+        
+        if(r != -1)
+        {
+            opt = OPT_L3HIT;    
+        }
+        else
+        {
+            opt = OPT_L3MISS;
+        }
+        
+        _addResultTime(opt, cache_access_speed_l3);
+    }
+        
+    return r;
+}
+
+int Simulator::_hitMemoL2(int chipID, int coreID, unsigned long loadingPage, bool isWrite)
+{
+    PROFILE_SCOPE(PROFILE_CHECK_L2);
+    
+    int tlbIndex = _checkMemoL2(chipID, coreID, loadingPage);
+    
+    if(tlbIndex == -1)
+    {
+        return -1;
+    }
+    
+    // the owner keeps its line, a read leaves it E and a write leaves it M, 
+    // the same as _readFromCacheL2 and _rewriteToCacheL2 without the owner and broadcast checks
+    chip *currentChip = &array_chips[chipID];
+    char state = isWrite ? 'M' : 'E';
+    
+    currentChip->tlb_l2[tlbIndex] = _setLineState(currentChip->tlb_l2[tlbIndex], state);
+    _moveToLRUTail(&currentChip->lru_l2, tlbIndex / currentChip->number_of_ways_l2, tlbIndex);
+    
+    _addLineResult(result_l2, tlbIndex, state);
+    
+    _addResultTime(OPT_L2HIT, currentChip->cache_access_speed_l2);
+    _addResultTime(isWrite ? OPT_L2WRITE : OPT_L2READ, currentChip->cache_access_speed_l2);
+    
+    return tlbIndex;
+}
+
+int Simulator::_checkMemoL2(int chipID, int coreID, unsigned long loadingPage)
+{
+    chip *currentChip = &array_chips[chipID];
+    int tlbIndex = currentChip->memo_block[coreID];
+    
+    if(tlbIndex == -1 || currentChip->memo_page[coreID] != loadingPage)
+    {
+        return -1;
+    }
+    
+    // it must still be valid, hold the same page and be owned by this core
+    unsigned long long line = currentChip->tlb_l2[tlbIndex];
+    unsigned long long tag = LINE_VALID | loadingPage | ((unsigned long long)coreID << LINE_OWNER_SHIFT);
+    
+    if((line & (LINE_VALID | LINE_OWNER_MASK | LINE_PAGE_MASK)) != tag)
+    {
+        return -1;
+    }
+    
+    char state = _getLineState(line);
+    
+    if(state != 'M' && state != 'E')
+    {
+        return -1;
+    }
+    
+    return tlbIndex;
+}
+
+void _initMemoL2(chip *currentChip)
+{
+    delete[] currentChip->memo_page;
+    delete[] currentChip->memo_block;
+    
+    // nothing touched by any core yet
+    currentChip->memo_page = new unsigned long[currentChip->number_of_core];
+    currentChip->memo_block = new int[currentChip->number_of_core];
+    
+    for(int i=0; i<currentChip->number_of_core; i++)
+    {
+        currentChip->memo_page[i] = 0;
+        currentChip->memo_block[i] = -1;
+    }
+}
+
+void Simulator::_rememberLineL2(int chipID, int coreID, int tlbIndex)
+{
+    chip *currentChip = &array_chips[chipID];
+    
+    currentChip->memo_page[coreID] = _getLinePage(currentChip->tlb_l2[tlbIndex]);
+    currentChip->memo_block[coreID] = tlbIndex;
+}
+
+void Simulator::_forgetLineL2(int chipID, int tlbIndex)
+{
+    chip *currentChip = &array_chips[chipID];
+    
+    for(int i=0; i<currentChip->number_of_core; i++)
+    {
+        if(currentChip->memo_block[i] == tlbIndex)
+        {
+            currentChip->memo_block[i] = -1;
+        }
+    }
+}
+
+int _findTagInSetScalar(const unsigned long long *lines, int length, unsigned long long tag)
+{
+    for(int i=0; i<length; i++)
+    {
+        if((lines[i] & (LINE_VALID | LINE_PAGE_MASK)) == tag)
+        {
+            return i;
+        }
+    }
+    
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+int _findTagInSetAVX2(const unsigned long long *lines, int length, unsigned long long tag)
+{
+    const __m256i mask = _mm256_set1_epi64x(LINE_VALID | LINE_PAGE_MASK);
+    const __m256i target = _mm256_set1_epi64x(tag);
+    int i = 0;
+    
+    for(; i+4<=length; i+=4)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(lines + i));
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_and_si256(v, mask), target);
+        int bits = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+        
+        if(bits != 0)
+        {
+            return i + __builtin_ctz(bits);
+        }
+    }
+    
+    // compare the ways left over
+    int r = _findTagInSetScalar(lines + i, length - i, tag);
+    
+    return r == -1 ? -1 : i + r;
+}
+
+__attribute__((target("avx512f")))
+int _findTagInSetAVX512(const unsigned long long *lines, int length, unsigned long long tag)
+{
+    const __m512i mask = _mm512_set1_epi64(LINE_VALID | LINE_PAGE_MASK);
+    const __m512i target = _mm512_set1_epi64(tag);
+    int i = 0;
+    
+    for(; i+8<=length; i+=8)
+    {
+        __m512i v = _mm512_loadu_si512((const void *)(lines + i));
+        __mmask8 bits = _mm512_cmpeq_epi64_mask(_mm512_and_si512(v, mask), target);
+        
+        if(bits != 0)
+        {
+            return i + __builtin_ctz(bits);
+        }
+    }
+    
+    int r = _findTagInSetScalar(lines + i, length - i, tag);
+    
+    return r == -1 ? -1 : i + r;
+}
+#else
+int _findTagInSetAVX2(const unsigned long long *lines, int length, unsigned long long tag)
+{
+    return _findTagInSetScalar(lines, length, tag);
+}
+
+int _findTagInSetAVX512(const unsigned long long *lines, int length, unsigned long long tag)
+{
+    return _findTagInSetScalar(lines, length, tag);
+}
+#endif
+
+int (*_selectFindTagInSet())(const unsigned long long *, int, unsigned long long)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    
+    if(__builtin_cpu_supports("avx512f"))
+    {
+        return _findTagInSetAVX512;
+    }
+    
+    if(__builtin_cpu_supports("avx2"))
+    {
+        return _findTagInSetAVX2;
+    }
+#endif
+    
+    return _findTagInSetScalar;
+}
+
+void Simulator::_addResultTime(opt_type opt, obj_time time)
+{
+    // keep the time of the first one, and its order for printing
+    if(result_time[opt].count == 0)
+    {
+        result_time[opt].time = time;
+        result_order[result_index] = opt;
+        result_index++;
+    }
+    
+    result_time[opt].count++;
+}
+
+int Simulator::_findAvailableBlockInCacheL2(int chipID, int setIndex)
+{
+    chip *currentChip = &array_chips[chipID];
+    
+    return _takeEmptyBlock(&currentChip->bitmap_l2, setIndex, currentChip->number_of_ways_l2);
+}
+
+int Simulator::_findAvailableBlockInCacheL3(int setIndex)
+{
+    return _takeEmptyBlock(bitmap_l3, setIndex, number_of_ways_l3);
+}
+
+void _initBlockBitmap(block_bitmap *bitmap, unsigned long totalBlocks, int numberOfSets)
+{
+    unsigned long length = (totalBlocks + 63) / 64;
+    int numberOfWays = totalBlocks / numberOfSets;
+    
+    bitmap->words = new unsigned long long[length];
+    bitmap->free_count = new int[numberOfSets];
+    bitmap->next_word = new int[numberOfSets];
+    
+    for(unsigned long i=0; i<length; i++)
+    {
+        bitmap->words[i] = ~0ULL;
+    }
+    
+    // clear the bits after the last block
+    if(totalBlocks % 64 != 0)
+    {
+        bitmap->words[length-1] = (1ULL << (totalBlocks % 64)) - 1;
+    }
+    
+    for(int i=0; i<numberOfSets; i++)
+    {
+        bitmap->free_count[i] = numberOfWays;
+        bitmap->next_word[i] = (long)i * numberOfWays / 64;
+    }
+}
+
+void _freeBlockBitmap(block_bitmap *bitmap)
+{
+    delete[] bitmap->words;
+    delete[] bitmap->free_count;
+    delete[] bitmap->next_word;
+}
+
+int _takeEmptyBlock(block_bitmap *bitmap, int setIndex, int numberOfWays)
+{
+    // the set is full, no need to search
+    if(bitmap->free_count[setIndex] == 0)
+    {
+        return -1;
+    }
+    
+    long first = (long)setIndex * numberOfWays;
+    int w = bitmap->next_word[setIndex];
+    
+    // skip the bits of the previous set sharing the first word
+    unsigned long long bits = bitmap->words[w];
+    
+    if(w == first / 64)
+    {
+        bits &= ~0ULL << (first % 64);
+    }
+    
+    // the set still has an empty block, so the lowest bit found is inside it
+    while(bits == 0)
+    {
+        bits = bitmap->words[++w];
+    }
+    
+    int block = w * 64 + __builtin_ctzll(bits);
+    
+    bitmap->words[w] &= ~(1ULL << (block % 64));
+    bitmap->free_count[setIndex]--;
+    bitmap->next_word[setIndex] = w;
+    
+    return block;
+}
+
+int Simulator::_takeTheFirstOutByLRU(int chipID, int setIndex)
+{ 
+    PROFILE_SCOPE(PROFILE_LRU);
+    
+    chip *currentChip = &array_chips[chipID];
+    int tlbIndex = _popLRUHead(&currentChip->lru_l2, setIndex);
+    unsigned long long oldLine = currentChip->tlb_l2[tlbIndex];
+    
+    if(oldLine & LINE_VALID)
+    {
+        _removePageFromIndex(&currentChip->index_l2, _getLinePage(oldLine));
+    }
+    
+    return tlbIndex;
+}
+
+int Simulator::_takeTheFirstOutL3ByLRU(int setIndex)
+{ 
+    PROFILE_SCOPE(PROFILE_LRU);
+    
+    int tlbIndex = _popLRUHead(lru_l3, setIndex);
+    unsigned long long oldLine = tlb_l3[tlbIndex];
+    
+    if(oldLine & LINE_VALID)
+    {
+        _removePageFromIndex(index_l3, _getLinePage(oldLine));
+    }
+    
+    return tlbIndex;
+}
+
+void Simulator::_swapTLBByLRU(int chipID, int tlbIndex)
+{
+    PROFILE_SCOPE(PROFILE_LRU);
+    
+    chip *currentChip = &array_chips[chipID];
+    
+    _moveToLRUTail(&currentChip->lru_l2, tlbIndex / currentChip->number_of_ways_l2, tlbIndex);
+}
+
+void Simulator::_swapTLBL3ByLRU(int tlbIndex)
+{
+    PROFILE_SCOPE(PROFILE_LRU);
+    
+    _moveToLRUTail(lru_l3, tlbIndex / number_of_ways_l3, tlbIndex);
+}
+
+void _initLRUList(lru_list *list, unsigned long totalBlocks, int numberOfSets)
+{
+    list->prev = new int[totalBlocks];
+    list->next = new int[totalBlocks];
+    list->head = new int[numberOfSets];
+    list->tail = new int[numberOfSets];
+    
+    for(unsigned long i=0; i<totalBlocks; i++)
+    {
+        list->prev[i] = -1;
+        list->next[i] = -1;
+    }
+    
+    for(int i=0; i<numberOfSets; i++)
+    {
+        list->head[i] = -1;
+        list->tail[i] = -1;
+    }
+}
+
+void _freeLRUList(lru_list *list)
+{
+    delete[] list->prev;
+    delete[] list->next;
+    delete[] list->head;
+    delete[] list->tail;
+}
+
+void _moveToLRUTail(lru_list *list, int setIndex, int tlbIndex)
+{
+    if(list->tail[setIndex] == tlbIndex)
+    {
+        return;
+    }
+    
+    // unlink it if it is in the list already
+    if(list->prev[tlbIndex] != -1 || list->head[setIndex] == tlbIndex)
+    {
+        if(list->prev[tlbIndex] != -1)
+        {
+            list->next[list->prev[tlbIndex]] = list->next[tlbIndex];
+        }
+        else
+        {
+            list->head[setIndex] = list->next[tlbIndex];
+        }
+        
+        list->prev[list->next[tlbIndex]] = list->prev[tlbIndex];
+    }
+    
+    // link it after the most recently used one
+    list->prev[tlbIndex] = list->tail[setIndex];
+    list->next[tlbIndex] = -1;
+    
+    if(list->tail[setIndex] != -1)
+    {
+        list->next[list->tail[setIndex]] = tlbIndex;
+    }
+    else
+    {
+        list->head[setIndex] = tlbIndex;
+    }
+    
+    list->tail[setIndex] = tlbIndex;
+}
+
+int _popLRUHead(lru_list *list, int setIndex)
+{
+    int tlbIndex = list->head[setIndex];
+    
+    list->head[setIndex] = list->next[tlbIndex];
+    
+    if(list->head[setIndex] != -1)
+    {
+        list->prev[list->head[setIndex]] = -1;
+    }
+    else
+    {
+        list->tail[setIndex] = -1;
+    }
+    
+    list->next[tlbIndex] = -1;
+    
+    return tlbIndex;
+}
+
+unsigned long long _makeLine(unsigned long page, int owner, char state)
+{
+    // the fields are masked, a page or owner too big for its bits can not reach the others
+    return _setLineState(LINE_VALID | (page & LINE_PAGE_MASK) | (((unsigned long long)owner << LINE_OWNER_SHIFT) & LINE_OWNER_MASK), state);
+}
+
+unsigned long _getLinePage(unsigned long long line)
+{
+    return line & LINE_PAGE_MASK;
+}
+
+int _getLineOwner(unsigned long long line)
+{
+    return (line & LINE_OWNER_MASK) >> LINE_OWNER_SHIFT;
+}
+
+char _getLineState(unsigned long long line)
+{
+    return LineStateNames[(line & LINE_STATE_MASK) >> LINE_STATE_SHIFT];
+}
+
+unsigned long long _setLineOwner(unsigned long long line, int owner)
+{
+    return (line & ~LINE_OWNER_MASK) | (((unsigned long long)owner << LINE_OWNER_SHIFT) & LINE_OWNER_MASK);
+}
+
+unsigned long long _setLineState(unsigned long long line, char state)
+{
+    unsigned long long code = 0;
+    
+    for(int i=0; i<4; i++)
+    {
+        if(LineStateNames[i] == state)
+        {
+            code = i;
+        }
+    }
+    
+    return (line & ~LINE_STATE_MASK) | (code << LINE_STATE_SHIFT);
+}
+
+void _initPageIndex(page_index *index, unsigned long totalBlocks)
+{
+    // keep the load factor under 1/2, so probing stays short
+    unsigned long buckets = 2;
+    
+    while(buckets < totalBlocks * 2)
+    {
+        buckets *= 2;
+    }
+    
+    index->keys = new unsigned long[buckets];
+    index->values = new int[buckets];
+    index->mask = buckets - 1;
+    
+    for(unsigned long i=0; i<buckets; i++)
+    {
+        index->keys[i] = 0;
+        index->values[i] = -1;
+    }
+}
+
+unsigned long _hashPage(unsigned long page, unsigned long mask)
+{
+    // multiplicative hashing spreads the consecutive pages of one access over the table
+    unsigned long long h = (unsigned long long)page * 0x9E3779B97F4A7C15ULL;
+    
+    return (unsigned long)(h ^ (h >> 32)) & mask;
+}
+
+int _findPageInIndex(page_index *index, unsigned long page)
+{
+    unsigned long i = _hashPage(page, index->mask);
+    
+    // linear probing, stop at the first empty bucket
+    while(index->values[i] != -1)
+    {
+        if(index->keys[i] == page)
+        {
+            return index->values[i];
+        }
+        
+        i = (i + 1) & index->mask;
+    }
+    
+    return -1;
+}
+
+void _addPageToIndex(page_index *index, unsigned long page, int tlbIndex)
+{
+    // set associative caches are not indexed
+    if(index->keys == NULL)
+    {
+        return;
+    }
+    
+    unsigned long i = _hashPage(page, index->mask);
+    
+    while(index->values[i] != -1 && index->keys[i] != page)
+    {
+        i = (i + 1) & index->mask;
+    }
+    
+    index->keys[i] = page;
+    index->values[i] = tlbIndex;
+}
+
+void _removePageFromIndex(page_index *index, unsigned long page)
+{
+    if(index->keys == NULL)
+    {
+        return;
+    }
+    
+    unsigned long i = _hashPage(page, index->mask);
+    
+    while(index->values[i] != -1 && index->keys[i] != page)
+    {
+        i = (i + 1) & index->mask;
+    }
+    
+    if(index->values[i] == -1)
+    {
+        return;
+    }
+    
+    // shift the following buckets back instead of leaving a tombstone
+    unsigned long j = i;
+    
+    while(true)
+    {
+        j = (j + 1) & index->mask;
+        
+        if(index->values[j] == -1)
+        {
+            break;
+        }
+        
+        unsigned long home = _hashPage(index->keys[j], index->mask);
+        
+        // move j into the hole unless its home bucket lies between the hole and j
+        if(((j - home) & index->mask) >= ((j - i) & index->mask))
+        {
+            index->keys[i] = index->keys[j];
+            index->values[i] = index->values[j];
+            i = j;
+        }
+    }
+    
+    index->values[i] = -1;
+}
+
+void _freePageIndex(page_index *index)
+{
+    delete[] index->keys;
+    delete[] index->values;
+    
+    index->keys = NULL;
+    index->values = NULL;
+}
+
+void Simulator::_printResult()
+{
+    PROFILE_SCOPE(PROFILE_PRINT);
+    
+    //// print TLB
+//    for(int i=0; i<currentChip.total_block_l2; i++)
+//    {
+//        cout << "TLB loadingPage is " << _getLinePage(currentChip.tlb_l2[i])
+//        << ", block ID is " << i << endl;    
 //    }
-//    else
+    
+    //// print L2 usage
+//    for(int i=0; i<currentChip.total_block_l2; i++)
 //    {
-//        cout << "chipID=" << chipID << ",coreID=" << coreID 
-//        << ",address=" << address << ",size=" << size.data << UnitSizeNames[size.unit] << endl;
+//        cout << "L2 usage is " << _getLineOwner(currentChip.tlb_l2[i]) << endl;
 //    }
     
-    unsigned long loadingPage = strtoul(address.c_str(), NULL, 16)/cache_line_size.data;
+//    // print L2 usage
+//    for(int i=0; i<total_block_l3; i++)
+//    {
+//        cout << "L3 usage is " << _getLineOwner(tlb_l3[i]) << endl;
+//    }
+
+    // print block id and state
+    obj_time totalTime={0,ns};
+     
+    _outputString("L2idx=");
+    
+    for(int i=0; i<result_l2->length; i++)
+    {
+        if(i > 0) _outputChar('&');
+        _outputNumber(result_l2->block[i]);
+    }
+    
+    if(number_of_chips > 1)
+    {
+        _outputString(" L3idx=");
+        
+        for(int i=0; i<result_l3->length; i++)
+        {
+            if(i > 0) _outputChar('&');
+            _outputNumber(result_l3->block[i]);
+        }
+    }
+    
+    // print time
+    _outputString(" time(");
+    
+    for(int i=0; i<result_index; i++)
+    {
+        opt_time *result = &result_time[result_order[i]];
+        
+        totalTime.data += result->time.data * result->count;
+        totalTime.unit = result->time.unit;
+        
+        _outputString(OptTypeNames[result_order[i]]);
+        _outputChar('=');
+        _outputNumber(result->time.data);
+        _outputString(UnitTimeNames[result->time.unit]);
+        
+        if(result->count > 1)
+        {
+            _outputChar('*');
+            _outputNumber(result->count);
+        }
+        
+        _outputString(", ");
+    }
+    
+    _outputString("total=");
+    _outputNumber(totalTime.data);
+    _outputString(UnitTimeNames[totalTime.unit]);
+    _outputChar(')');
+    
+    if(number_of_chips > 1)
+    {
+        _outputString(" L2state=");
+        
+        for(int i=0; i<result_l2->length; i++)
+        {
+            if(i > 0) _outputChar('&');
+            _outputChar(result_l2->state[i]);
+        }
+        
+        _outputString(" L3state=");
+        
+        for(int i=0; i<result_l3->length; i++)
+        {
+            if(i > 0) _outputChar('&');
+            _outputChar(result_l3->state[i]);
+        }
+    }
+    else
+    {
+        _outputString(" state=");
+        
+        for(int i=0; i<result_l2->length; i++)
+        {
+            if(i > 0) _outputChar('&');
+            _outputChar(result_l2->state[i]);
+        }
+    }
+    
+    _outputString("\n\n");
+}
+
+void Simulator::_clearResult()
+{
+    for(int i=0; i<result_index; i++)
+    {
+        result_time[result_order[i]].count = 0;
+    }
+    
+    result_index = 0;
+    result_l2->length = 0;
+    result_l3->length = 0;
+}
+
+void Simulator::_collectStats(int chipID, int coreID, bool isWrite)
+{
+    // chips and cores are known after the first read or write
+    if(chip_stats == NULL)
+    {
+        chip_stats = new core_stats*[number_of_chips];
+        stats_cores = new int[number_of_chips];
+        
+        for(int i=0; i<number_of_chips; i++)
+        {
+            stats_cores[i] = array_chips[i].number_of_core;
+            chip_stats[i] = new core_stats[stats_cores[i]]();
+        }
+    }
+    
+    if(coreID >= stats_cores[chipID]) return;
+    
+    core_stats *stats = &chip_stats[chipID][coreID];
+    
+    if(isWrite)
+    {
+        stats->writes++;
+    }
+    else
+    {
+        stats->reads++;
+    }
+    
+    for(int i=0; i<result_index; i++)
+    {
+        opt_time *result = &result_time[result_order[i]];
+        
+        stats->counts[result_order[i]] += result->count;
+        stats->time += result->time.data * result->count * (result->time.unit == us ? 1000 : 1);
+    }
+    
+    stats_accesses++;
+}
+
+void Simulator::printStats()
+{
+    core_stats total = core_stats();
+    
+    if(shards != NULL)
+    {
+        _drainShards();
+    }
+    
+    if(stages != NULL)
+    {
+        _drainStages();
+    }
+    
+    _outputString("Summary after ");
+    _outputNumber(stats_accesses);
+    _outputString(" reads and writes:\n");
+    
+    for(int i=0; chip_stats != NULL && i<number_of_chips; i++)
+    {
+        core_stats chipTotal = core_stats();
+        
+        for(int j=0; j<stats_cores[i]; j++)
+        {
+            core_stats *stats = &chip_stats[i][j];
+            
+            _outputString("chip ");
+            _outputNumber(i);
+            _outputString(" core ");
+            _outputNumber(j);
+            _outputString(": ");
+            _printStatsLine(stats);
+            _addStats(&chipTotal, stats);
+        }
+        
+        _outputString("chip ");
+        _outputNumber(i);
+        _outputString(": ");
+        _printStatsLine(&chipTotal);
+        _addStats(&total, &chipTotal);
+    }
+    
+    _outputString("total: ");
+    _printStatsLine(&total);
+    _outputChar('\n');
+}
+
+bool Simulator::getStats(int chipID, int coreID, core_stats *stats)
+{
+    *stats = core_stats();
+    
+    // cores are only known after numOfCores
+    if(chipID < -1 || chipID >= number_of_chips || coreID < -1 || (chipID == -1 && coreID != -1)) return 0;
+    if(coreID != -1 && (array_chips == NULL || coreID >= array_chips[chipID].number_of_core)) return 0;
+    
+    if(shards != NULL)
+    {
+        _drainShards();
+    }
+    
+    if(stages != NULL)
+    {
+        _drainStages();
+    }
+    
+    for(int i=0; chip_stats != NULL && i<number_of_chips; i++)
+    {
+        if(chipID != -1 && i != chipID) continue;
+        
+        for(int j=0; j<stats_cores[i]; j++)
+        {
+            if(coreID == -1 || j == coreID)
+            {
+                _addStats(stats, &chip_stats[i][j]);
+            }
+        }
+    }
+    
+    return 1;
+}
+
+void _addStats(core_stats *total, const core_stats *stats)
+{
+    total->reads += stats->reads;
+    total->writes += stats->writes;
+    total->time += stats->time;
+    
+    for(int i=0; i<NUMBER_OF_OPTS; i++)
+    {
+        total->counts[i] += stats->counts[i];
+    }
+}
+
+const char *Simulator::_analyzeAccess(int chipID, int coreID, unsigned long address, obj_size size, bool isWrite)
+{
+    unsigned long loadingPage = address/cache_line_size.data;
+    
+    // the same lines as a read or write, an invalid address is ignored
+    if(loadingPage > memory_pages) return NULL;
+    
+    unsigned long loadingPageSize = _caculateNeedBlocks(address, size);
+    
+    if(chipID == -1) 
+    {
+        chipID = 0;           
+    }
+    
+    const char *error = _checkValidIDs(chipID, coreID);
+    
+    if(error != NULL)
+    {
+        return error;
+    }
+    
+    // chips are known after the first read or write, the analysis of a chip is built at its first read or write
+    if(stack_l2 == NULL)
+    {
+        stack_l2 = new stack_distance[number_of_chips]();
+        _initStackDistance(stack_l3);
+    }
+    
+    if(stack_l2[chipID].marks == NULL)
+    {
+        _initStackDistance(&stack_l2[chipID]);
+    }
+    
+    // the cores of a chip share its L2, all chips share L3, which like the simulation only sees the writes
+    // and the lines that miss in L2, here an LRU L2 of all the blocks of the chip in the trace
+    for(unsigned long i=0; i<loadingPageSize; i++)
+    {
+        unsigned long distance = _addStackAccess(&stack_l2[chipID], loadingPage + i);
+        
+        if(number_of_chips > 1 && (isWrite || distance >= (unsigned long)array_chips[chipID].total_block_l2))
+        {
+            _addStackAccess(stack_l3, loadingPage + i);
+        }
+    }
+    
+    return NULL;
+}
+
+void Simulator::printMissRatioCurves()
+{
+    _outputString("cache,blocks,size,accesses,misses,miss_ratio\n");
+    
+    for(int i=0; stack_l2 != NULL && i<number_of_chips; i++)
+    {
+        _printMissRatioCurve(i, &stack_l2[i]);
+    }
+    
+    if(stack_l2 != NULL && number_of_chips > 1)
+    {
+        _printMissRatioCurve(-1, stack_l3);
+    }
+}
+
+void Simulator::_printMissRatioCurve(int chipID, const stack_distance *stack)
+{
+    unsigned long lineBytes = cache_line_size.data << (10 * cache_line_size.unit);
+    unsigned long longest = 0;
+    unsigned long hits = 0;
+    unsigned long distance = 0;
+    
+    for(unsigned long i=0; i<stack->histogram_length; i++)
+    {
+        if(stack->histogram[i] > 0) longest = i;
+    }
+    
+    // one row for each power of 2 blocks, until every access that is not the first to its line hits
+    for(unsigned long blocks=1; ; blocks*=2)
+    {
+        for(; distance<blocks && distance<stack->histogram_length; distance++)
+        {
+            hits += stack->histogram[distance];
+        }
+        
+        unsigned long misses = stack->accesses - hits;
+        unsigned long bytes = blocks * lineBytes;
+        int unit = B;
+        char ratio[32];
+        
+        while(unit < GB && bytes % 1024 == 0)
+        {
+            bytes /= 1024;
+            unit++;
+        }
+        
+        snprintf(ratio, sizeof(ratio), "%.6f", stack->accesses > 0 ? (double)misses / stack->accesses : 0.0);
+        
+        if(chipID == -1)
+        {
+            _outputString("L3");
+        }
+        else
+        {
+            _outputString("chip ");
+            _outputNumber(chipID);
+        }
+        
+        _outputChar(',');
+        _outputNumber(blocks);
+        _outputChar(',');
+        _outputNumber(bytes);
+        _outputString(UnitSizeNames[unit]);
+        _outputChar(',');
+        _outputNumber(stack->accesses);
+        _outputChar(',');
+        _outputNumber(misses);
+        _outputChar(',');
+        _outputString(ratio);
+        _outputChar('\n');
+        
+        if(blocks > longest) break;
+    }
+}
+
+void _initStackDistance(stack_distance *stack)
+{
+    _initPageIndex(&stack->last, STACK_TIMES / 2);
+    
+    stack->lines = 0;
+    stack->now = 0;
+    stack->capacity = STACK_TIMES;
+    stack->marks = new long[stack->capacity + 1]();
+    stack->line_at = new unsigned long[stack->capacity];
+    stack->histogram_length = STACK_DISTANCES;
+    stack->histogram = new unsigned long[stack->histogram_length]();
+    stack->accesses = 0;
+    stack->cold = 0;
+}
+
+void _freeStackDistance(stack_distance *stack)
+{
+    _freePageIndex(&stack->last);
+    
+    delete[] stack->marks;
+    delete[] stack->line_at;
+    delete[] stack->histogram;
+}
+
+unsigned long _addStackAccess(stack_distance *stack, unsigned long line)
+{
+    if(stack->now == stack->capacity)
+    {
+        _packStackTimes(stack);
+    }
+    
+    int last = _findPageInIndex(&stack->last, line);
+    unsigned long distance = (unsigned long)-1;
+    
+    stack->accesses++;
+    
+    if(last == -1)
+    {
+        stack->cold++;
+        stack->lines++;
+        
+        // keep the load factor of the index under 1/2
+        if(stack->lines * 2 > stack->last.mask + 1)
+        {
+            _growStackLines(stack);
+        }
+    }
+    else
+    {
+        // every line accessed since is marked once, at its own last access
+        distance = _sumFenwick(stack->marks, stack->now) - _sumFenwick(stack->marks, last + 1);
+        
+        if(distance >= stack->histogram_length)
+        {
+            unsigned long length = stack->histogram_length;
+            
+            while(length <= distance) length *= 2;
+            
+            unsigned long *histogram = new unsigned long[length]();
+            
+            memcpy(histogram, stack->histogram, sizeof(unsigned long) * stack->histogram_length);
+            delete[] stack->histogram;
+            
+            stack->histogram = histogram;
+            stack->histogram_length = length;
+        }
+        
+        stack->histogram[distance]++;
+        _addFenwick(stack->marks, stack->capacity, last, -1);
+    }
+    
+    _addFenwick(stack->marks, stack->capacity, stack->now, 1);
+    _addPageToIndex(&stack->last, line, stack->now);
+    stack->line_at[stack->now] = line;
+    stack->now++;
+    
+    return distance;
+}
+
+void _growStackLines(stack_distance *stack)
+{
+    page_index last = stack->last;
+    
+    _initPageIndex(&stack->last, stack->lines * 2);
+    
+    for(unsigned long i=0; i<=last.mask; i++)
+    {
+        if(last.values[i] != -1)
+        {
+            _addPageToIndex(&stack->last, last.keys[i], last.values[i]);
+        }
+    }
+    
+    _freePageIndex(&last);
+}
+
+void _packStackTimes(stack_distance *stack)
+{
+    // only the last access of each line is still needed, keep them in order from time 0
+    unsigned long capacity = stack->lines * 2 + STACK_TIMES;
+    unsigned long *lineAt = new unsigned long[capacity];
+    unsigned long now = 0;
+    
+    for(unsigned long i=0; i<stack->now; i++)
+    {
+        unsigned long line = stack->line_at[i];
+        
+        if(_findPageInIndex(&stack->last, line) == (int)i)
+        {
+            _addPageToIndex(&stack->last, line, now);
+            lineAt[now++] = line;
+        }
+    }
+    
+    // build the Fenwick tree of all 1s in one pass
+    delete[] stack->marks;
+    stack->marks = new long[capacity + 1]();
+    
+    for(unsigned long i=1; i<=capacity; i++)
+    {
+        if(i <= now) stack->marks[i] += 1;
+        
+        unsigned long parent = i + (i & (~i + 1));
+        
+        if(parent <= capacity) stack->marks[parent] += stack->marks[i];
+    }
+    
+    delete[] stack->line_at;
     
-    if(loadingPage > memory_pages)
+    stack->line_at = lineAt;
+    stack->now = now;
+    stack->capacity = capacity;
+}
+
+void _addFenwick(long *tree, unsigned long capacity, unsigned long position, long delta)
+{
+    for(unsigned long i=position+1; i<=capacity; i+=i & (~i + 1))
     {
-        cout << "Invalid address, out of memory pages range, ignore this command!" << endl;
-        return;               
+        tree[i] += delta;
     }
+}
+
+long _sumFenwick(const long *tree, unsigned long length)
+{
+    long sum = 0;
     
-    int loadingPageSize = _caculateNeedBlocks(strtoul(address.c_str(), NULL, 16), size);
+    for(unsigned long i=length; i>0; i-=i & (~i + 1))
+    {
+        sum += tree[i];
+    }
     
-    cout << "loading page is " << loadingPage << ",page size is " << loadingPageSize << endl;
+    return sum;
+}
+
+void Simulator::_copyConfig(Simulator *copy, int divisor, int firstChip, int lastChip, bool isL3)
+{
+    // the same ways and speeds, only the summary is kept
+    copy->quiet_output = 1;
+    copy->output = NULL;
+    copy->memorySize(memory_size);
+    copy->numOfChips(number_of_chips);
+    copy->cacheLineSize(cache_line_size);
     
-    int pages[loadingPageSize];
-     
-    if(chipID == -1) 
+    for(int i=0; i<number_of_chips; i++)
     {
-        chipID = 0;           
+        copy->numOfCores(i, array_chips[i].number_of_core);
     }
     
-    _checkValidIDs(chipID, coreID);
-    
-    chip currentChip = array_chips[chipID];
+    for(int i=firstChip; i<lastChip; i++)
+    {
+        chip *currentChip = &array_chips[i];
+        obj_size size = {currentChip->total_block_l2 / divisor * cache_line_size.data, cache_line_size.unit};
+        
+        // a chip without L2 stays without it
+        if(currentChip->total_block_l2 > 0)
+        {
+            copy->cacheSize(i, size);
+            copy->cacheAssociativity(i, currentChip->number_of_ways_l2);
+        }
+        
+        copy->cacheAccessSpeed(i, currentChip->cache_access_speed_l2);
+    }
     
-    for(int i=0; i<loadingPageSize; i++, loadingPage++) 
-    {  
-       pages[i] = loadingPage;
-       
-       int isExisting = _checkCacheL2(chipID, loadingPage, 1);
-       
-       // if not -1, find it in L2, read it
-       if(isExisting != -1)
-       {
-           _readFromCacheL2(chipID, coreID, isExisting);   
-       }
-       else
-       {
-           // not in L2 ,try L3
-           if(number_of_chips > 1)
-           {
-               isExisting = _checkCacheL3(chipID, loadingPage, 1);
-               
-               // if not -1, find it in L3
-               if(isExisting != -1)
-               {
-                   _readFromCacheL3(chipID, coreID, isExisting);
-               }
-               else
-               {
-                   // load from memory and write L2
-                   _loadMemToCacheL2(chipID, coreID, loadingPage);
-                   
-                   // write L3
-                   _writeToCacheL3(chipID, coreID, loadingPage, 1);
-               }
-           }
-           else
-           {
-               // load from memory and write L2
-               _loadMemToCacheL2(chipID, coreID, loadingPage);
-           }
-       }    
+    if(isL3)
+    {
+        obj_size size = {total_block_l3 / divisor * cache_line_size.data, cache_line_size.unit};
+        
+        copy->cacheSize(-1, size);
+        copy->cacheAssociativity(-1, number_of_ways_l3);
+        copy->cacheAccessSpeed(-1, cache_access_speed_l3);
     }
     
-    _printResult(chipID, pages, loadingPageSize);
+    copy->replacementSpeed(replacement_speed);
+    copy->broadcastSpeed(broadcast_speed);
+    copy->memoryAccessSpeed(memory_access_speed);
 }
 
-void write(int chipID, int coreID, string address, obj_size size)
+bool Simulator::_startShards()
 {
-    //cout << "write test enter" << endl;
+    // a line maps to sets of the same remainder in every cache if the number of shards divides all numbers of sets
+    int sets = (number_of_chips > 1) ? number_of_sets_l3 : 0;
     
-    //if(chipID == -1)
-//    {
-//        cout << "coreID=" << coreID 
-//        << ",address=" << address << ",size=" << size.data << UnitSizeNames[size.unit] << endl;      
-//    }
-//    else
-//    {
-//        cout << "chipID=" << chipID << ",coreID=" << coreID 
-//        << ",address=" << address << ",size=" << size.data << UnitSizeNames[size.unit] << endl;
-//    }
+    for(int i=0; i<number_of_chips; i++)
+    {
+        int rest = array_chips[i].number_of_sets_l2;
+        
+        while(rest != 0)
+        {
+            int temp = sets % rest;
+            sets = rest;
+            rest = temp;
+        }
+    }
     
-    unsigned long loadingPage = strtoul(address.c_str(), NULL, 16)/cache_line_size.data;
+    int number = shard_threads;
+    
+    while(number > 1 && sets % number != 0) {number--;};
+    
+    // each line and its result are printed or exported in order, only the summary can be sharded,
+    // the trace still runs on one thread, with a notice on standard error of why
+    if(number < 2 || !quiet_output || export_file != NULL)
+    {
+        fprintf(stderr, "Simulating on one thread, %s!\n", 
+                export_file != NULL ? "export needs each read and write in order" :
+                !quiet_output ? "printing each read and write needs them in order" :
+                "no number of threads above 1 divides the number of sets of every cache, cacheAssociativity splits the caches into sets");
+        shard_threads = 0;
+        return 0;
+    }
+    
+    number_of_shards = number;
+    shards = new Simulator[number];
+    shard_workers = new worker_thread[number];
+    shard_rings = new batch_ring[number];
+    shard_pending = new shard_batch[number]();
+    
+    for(int s=0; s<number; s++)
+    {
+        Simulator *shard = &shards[s];
+        
+        // a shard has 1/number of the sets of each cache
+        _copyConfig(shard, number, 0, number_of_chips, number_of_chips > 1);
+        
+        shard_workers[s] = thread(&Simulator::_shardStage, shard, &shard_rings[s]);
+    }
+    
+    return 1;
+}
+
+const char *Simulator::_shardAccess(int chipID, int coreID, unsigned long address, obj_size size, bool isWrite)
+{
+    unsigned long loadingPage = address/cache_line_size.data;
     
     if(loadingPage > memory_pages)
     {
-        cout << "Invalid address, out of memory pages range, ignore this command!" << endl << endl;
-        return;               
+        _outputString(isWrite ? "Invalid address, out of memory pages range, ignore this command!\n\n" : 
+                                "Invalid address, out of memory pages range, ignore this command!\n");
+        return NULL;               
     }
     
-    int loadingPageSize = _caculateNeedBlocks(strtoul(address.c_str(), NULL, 16), size);
+    int loadingPageSize = _caculateNeedBlocks(address, size);
     
-    cout << "loading page is " << loadingPage << ",page size is " << loadingPageSize << endl;
-     
     if(chipID == -1) 
     {
         chipID = 0;           
     }
     
-    _checkValidIDs(chipID, coreID);
+    const char *error = _checkValidIDs(chipID, coreID);
     
-    int pages[loadingPageSize];
-    chip currentChip = array_chips[chipID];
+    if(error != NULL)
+    {
+        return error;
+    }
     
-    for(int i=0; i<loadingPageSize; i++, loadingPage++) 
+    // page p is in the sets of remainder p % number_of_shards, and it is page p / number_of_shards in that shard
+    for(int i=0; i<loadingPageSize; i++, loadingPage++)
     {
-       pages[i] = loadingPage;
-       
-       int isExisting = _checkCacheL2(chipID, loadingPage, 1);
-       
-       if(isExisting != -1)
-       {
-           // rewrite L2
-           _rewriteToCacheL2(chipID, coreID, isExisting);
-           
-           if(number_of_chips > 1)
-           {
-               isExisting = _checkCacheL3(chipID, loadingPage, 0);
-               
-               // rewrite L3 and mark other L2 as invalid
-               _rewriteToCacheL3(chipID, coreID, isExisting, loadingPage);    
-           }
-       }
-       else
-       {
-           // write L2
-           _writeToCacheL2(chipID, coreID, loadingPage);
-           
-           if(number_of_chips > 1)
-           {
-               isExisting = _checkCacheL3(chipID, loadingPage, 1);
-               
-               if(isExisting != -1)
-               {
-                   // if exist in L3, rewrite L3 and mark other L2 as invalid
-                   _rewriteToCacheL3(chipID, coreID, isExisting, loadingPage); 
-               }
-               else
-               {
-                   // if not exist, write L3
-                   _writeToCacheL3(chipID, coreID, loadingPage, 0);
-               }   
-           }
-       }    
+        shard_batch *batch = &shard_pending[loadingPage % number_of_shards];
+        shard_line *line = &batch->lines[batch->length++];
+        
+        line->page = loadingPage / number_of_shards;
+        line->chip_id = chipID;
+        line->core_id = coreID;
+        line->is_write = isWrite;
+        
+        if(batch->length == SHARD_BATCH_LINES)
+        {
+            _pushRing(&shard_rings[loadingPage % number_of_shards], *batch);
+            batch->length = 0;
+        }
+    }
+    
+    // the reads and writes are counted here, the operations and time by the shards
+    _collectStats(chipID, coreID, isWrite);
+    
+    if(stats_interval > 0 && stats_accesses % stats_interval == 0)
+    {
+        printStats();
+    }
+    
+    return NULL;
+}
+
+void Simulator::_shardStage(batch_ring *batches)
+{
+    obj_size size = {1, B};
+    
+    while(1)
+    {
+        shard_batch *batch = _peekRing(batches);
+        
+        if(batch->done) break;
+        
+        for(int i=0; i<batch->length; i++)
+        {
+            shard_line *line = &batch->lines[i];
+            
+            if(line->is_write)
+            {
+                _writeAddress(line->chip_id, line->core_id, line->page * cache_line_size.data, size);
+            }
+            else
+            {
+                _readAddress(line->chip_id, line->core_id, line->page * cache_line_size.data, size);
+            }
+        }
+        
+        _popRing(batches);
+    }
+}
+
+void Simulator::_drainShards()
+{
+    for(int s=0; s<number_of_shards; s++)
+    {
+        if(shard_pending[s].length > 0)
+        {
+            _pushRing(&shard_rings[s], shard_pending[s]);
+            shard_pending[s].length = 0;
+        }
     }
+    
+    for(int s=0; s<number_of_shards; s++)
+    {
+        batch_ring *ring = &shard_rings[s];
         
-    _printResult(chipID, pages, loadingPageSize);   
+        while(ring->head.load(memory_order_acquire) != ring->tail.load(memory_order_relaxed)) {this_thread::yield();};
+        
+        // the shard is waiting, its counters are moved into this simulator
+        _moveStats(&shards[s]);
+    }
+}
+
+void Simulator::_moveStats(Simulator *from)
+{
+    // the reads and writes are counted by this simulator
+    for(int i=0; from->chip_stats != NULL && chip_stats != NULL && i<number_of_chips; i++)
+    {
+        for(int j=0; j<stats_cores[i]; j++)
+        {
+            core_stats *stats = &from->chip_stats[i][j];
+            
+            stats->reads = 0;
+            stats->writes = 0;
+            _addStats(&chip_stats[i][j], stats);
+            *stats = core_stats();
+        }
+    }
 }
 
-string _getFunctionName(const string strLine)
-{   
-    string:: size_type position;
+void Simulator::_stopShards()
+{
+    _drainShards();
+    
+    for(int s=0; s<number_of_shards; s++)
+    {
+        shard_pending[s].done = 1;
+        _pushRing(&shard_rings[s], shard_pending[s]);
+        shard_workers[s].join();
+    }
     
-    position = strLine.find("(");
+    delete[] shards;
+    delete[] shard_workers;
+    delete[] shard_rings;
+    delete[] shard_pending;
     
-    return strLine.substr(0, position);
+    shards = NULL;
+    number_of_shards = 0;
 }
 
-obj_size _getSize(const string strLine, bool isRW)
+bool Simulator::_startStages()
 {
-    //cout << "_getSize test enter" << endl;     
-    string:: size_type pos_start;
-    string:: size_type pos_end;
-       
-    obj_size size;
+    // each line and its result are printed or exported in order, only the summary can be staged,
+    // the trace still runs on one thread, with a notice on standard error of why
+    bool isMissingL2 = 0;
+    
+    for(int i=0; i<number_of_chips; i++)
+    {
+        isMissingL2 = isMissingL2 || array_chips[i].total_block_l2 == 0;
+    }
+    
+    if(number_of_chips < 2 || !quiet_output || export_file != NULL || isMissingL2)
+    {
+        fprintf(stderr, "Simulating on one thread, %s!\n", 
+                export_file != NULL ? "export needs each read and write in order" :
+                !quiet_output ? "printing each read and write needs them in order" :
+                number_of_chips < 2 ? "one chip has no L3 to resolve on another thread" :
+                "a chip without L2 has no stage of its own");
+        chip_threads = 0;
+        return 0;
+    }
+    
+    stages = new Simulator[number_of_chips + 1];
+    stage_workers = new worker_thread[number_of_chips + 1];
+    stage_lines = new coherence_line_ring[number_of_chips];
+    stage_events = new coherence_event_ring[number_of_chips];
+    stage_effects = new coherence_event_ring[number_of_chips];
+    stage_order = new chip_order_ring;
+    resolved_lines = new line_counter;
+    next_line = 0;
+    write_at = new unsigned long*[number_of_chips];
+    
+    for(int i=0; i<number_of_chips; i++)
+    {
+        write_at[i] = new unsigned long[array_chips[i].number_of_sets_l2]();
+        
+        _copyConfig(&stages[i], 1, i, i + 1, 0);
+        stage_workers[i] = thread(&Simulator::_chipStage, &stages[i], i, &stage_lines[i], &stage_events[i], &stage_effects[i], resolved_lines);
+    }
     
-    if(isRW)
+    // the last stage has only L3, its invalidations go to the chips
+    Simulator *l3 = &stages[number_of_chips];
+    
+    _copyConfig(l3, 1, 0, 0, 1);
+    l3->effect_rings = stage_effects;
+    stage_workers[number_of_chips] = thread(&Simulator::_l3Stage, l3, stage_order, stage_events, resolved_lines);
+    
+    return 1;
+}
+
+const char *Simulator::_stageAccess(int chipID, int coreID, unsigned long address, obj_size size, bool isWrite)
+{
+    unsigned long loadingPage = address/cache_line_size.data;
+    
+    if(loadingPage > memory_pages)
+    {
+        _outputString(isWrite ? "Invalid address, out of memory pages range, ignore this command!\n\n" :
+                                "Invalid address, out of memory pages range, ignore this command!\n");
+        return NULL;
+    }
+    
+    int loadingPageSize = _caculateNeedBlocks(address, size);
+    
+    if(chipID == -1)
+    {
+        chipID = 0;
+    }
+    
+    const char *error = _checkValidIDs(chipID, coreID);
+    
+    if(error != NULL)
+    {
+        return error;
+    }
+    
+    for(int i=0; i<loadingPageSize; i++, loadingPage++)
+    {
+        coherence_line line = {next_line, loadingPage, 0, coreID, isWrite, 0};
+        
+        line.wait = write_at[chipID][loadingPage % array_chips[chipID].number_of_sets_l2];
+        
+        // a write may invalidate the page in L2 of any chip
+        if(isWrite)
+        {
+            for(int j=0; j<number_of_chips; j++)
+            {
+                write_at[j][loadingPage % array_chips[j].number_of_sets_l2] = next_line + 1;
+            }
+        }
+        
+        _pushRing(&stage_lines[chipID], line);
+        _pushRing(stage_order, chipID);
+        next_line++;
+    }
+    
+    // the reads and writes are counted here, the operations and time by the stages
+    _collectStats(chipID, coreID, isWrite);
+    
+    if(stats_interval > 0 && stats_accesses % stats_interval == 0)
+    {
+        printStats();
+    }
+    
+    return NULL;
+}
+
+void Simulator::_chipStage(int chipID, coherence_line_ring *lines, coherence_event_ring *events,
+                           coherence_event_ring *effects, line_counter *resolved)
+{
+    int sets = array_chips[chipID].number_of_sets_l2;
+    unsigned long *missAt = new unsigned long[sets](); // 1 + the sequence number of the last read miss in each set, 0 for none
+    coherence_line *line;
+    
+    while(1)
     {
-        if(_getChipID(strLine) == -1) 
+        // keep taking the effects while there is no line, the L3 stage may wait for room to pass them
+        while((line = _tryPeekRing(lines)) == NULL)
+        {
+            _applyEffects(chipID, effects);
+            this_thread::yield();
+        }
+        
+        if(line->done) break;
+        
+        // the set must have what the L3 stage did for the earlier lines that may change it
+        int setIndex = line->page % sets;
+        unsigned long wait = line->wait > missAt[setIndex] ? line->wait : missAt[setIndex];
+        
+        while(resolved->load(memory_order_acquire) < wait)
+        {
+            _applyEffects(chipID, effects);
+            this_thread::yield();
+        }
+        
+        _applyEffects(chipID, effects);
+        
+        coherence_event event = {line->page, line->core_id, COHERENCE_NONE};
+        int isMemo = _hitMemoL2(chipID, line->core_id, line->page, line->is_write);
+        int isExisting = isMemo != -1 ? isMemo : _checkCacheL2(chipID, line->page, 1);
+        
+        if(line->is_write)
+        {
+            if(isExisting != -1)
+            {
+                if(isMemo == -1)
+                {
+                    _rewriteToCacheL2(chipID, line->core_id, isExisting);
+                }
+                
+                event.kind = COHERENCE_WRITE_HIT;
+            }
+            else
+            {
+                _writeToCacheL2(chipID, line->core_id, line->page);
+                event.kind = COHERENCE_WRITE_MISS;
+            }
+        }
+        else if(isExisting != -1)
         {
-            pos_start = strLine.find(",");
-            pos_start = strLine.find(",", pos_start+1);
-            pos_end = strLine.find(")");
+            if(isMemo == -1)
+            {
+                _readFromCacheL2(chipID, line->core_id, isExisting);
+            }
         }
         else
         {
-            pos_start = strLine.find(",");
-            pos_start = strLine.find(",", pos_start+1);
-            pos_start = strLine.find(",", pos_start+1);
-            pos_end = strLine.find(")");
+            // L2 is filled only if L3 misses too
+            event.kind = COHERENCE_READ_MISS;
+            missAt[setIndex] = line->sequence + 1;
         }
         
-        // remove the space before the number
-        while(isspace(strLine.at(pos_start+1))) {pos_start++;};    
+        _collectStats(chipID, line->core_id, line->is_write);
+        _clearResult();
+        
+        _pushRing(events, event);
+        _popRing(lines);
     }
-    else
+    
+    delete[] missAt;
+}
+
+void Simulator::_applyEffects(int chipID, coherence_event_ring *effects)
+{
+    coherence_event *effect;
+    
+    while((effect = _tryPeekRing(effects)) != NULL)
     {
-        if(_getChipID(strLine) == -1) 
+        if(effect->kind == COHERENCE_FILL)
         {
-            pos_start = strLine.find("(");
-            pos_end = strLine.find(")");
+            _loadMemToCacheL2(chipID, effect->core_id, effect->page);
+            _collectStats(chipID, effect->core_id, 0);
+            _clearResult();
         }
         else
         {
-            pos_start = strLine.find(",");
-            pos_end = strLine.find(")");
-            
-            // remove the space before the number
-            while(isspace(strLine.at(pos_start+1))) {pos_start++;};    
+            _invalidateLineL2(chipID, effect->page);
         }
+        
+        _popRing(effects);
     }
-    
-    //cout << "pos_start is " << strLine[pos_start] << endl;
-    //cout << "pos_end is " << strLine[pos_end] << endl;
-       
-    if(pos_start != strLine.npos && pos_end != strLine.npos && pos_start < pos_end) 
+}
+
+void Simulator::_l3Stage(chip_order_ring *order, coherence_event_ring *events, line_counter *resolved)
+{
+    // one event for each line, taken in the order of the trace
+    for(unsigned long sequence=0; ; sequence++)
     {
-        string temp = "";
-        
-        if(!isdigit(strLine.at(pos_start+1))) 
-        {
-            cout << "_getSize::Not found expected number, invalid input!" << endl;
-            exit(1);
-        }
+        int chipID = *_peekRing(order);
         
-        // get the number part
-        while(isdigit(strLine.at(++pos_start))) {temp+=strLine.at(pos_start);};
-        size.data = atol(temp.c_str());
+        if(chipID == -1) break;
         
-        // remove the space between number and unit
-        while(isspace(strLine.at(pos_start))) {pos_start++;};
+        coherence_event *event = _peekRing(&events[chipID]);
         
-        // get the unit part, like B, KB, MB, or GB
-        if(strLine[pos_start] == 'B' && strLine[pos_start+1] == ')') 
-        {
-           size.unit = B;             
-        } 
-        else if(strLine[pos_start] == 'K' && strLine[pos_start+1] == 'B' && strLine[pos_start+2] == ')') 
-        {
-           size.unit = KB;     
-        } 
-        else if(strLine[pos_start] == 'M' && strLine[pos_start+1] == 'B' && strLine[pos_start+2] == ')') 
+        if(event->kind == COHERENCE_READ_MISS)
         {
-           size.unit = MB; 
-        } 
-        else if(strLine[pos_start] == 'G' && strLine[pos_start+1] == 'B' && strLine[pos_start+2] == ')') 
+            int isExisting = _checkCacheL3(chipID, event->page, 1);
+            
+            if(isExisting != -1)
+            {
+                _readFromCacheL3(chipID, event->core_id, isExisting);
+            }
+            else
+            {
+                coherence_event effect = {event->page, event->core_id, COHERENCE_FILL};
+                
+                _pushRing(&effect_rings[chipID], effect);
+                _writeToCacheL3(chipID, event->core_id, event->page, 1);
+            }
+        }
+        else if(event->kind != COHERENCE_NONE)
         {
-           size.unit = GB;     
-        } 
-        else 
+            // a write which hits in L2 checks L3 without its time
+            int isExisting = _checkCacheL3(chipID, event->page, event->kind == COHERENCE_WRITE_MISS);
+            
+            if(isExisting != -1)
+            {
+                _rewriteToCacheL3(chipID, event->core_id, isExisting, event->page);
+            }
+            else
+            {
+                _writeToCacheL3(chipID, event->core_id, event->page, 0);
+            }
+        }
+        
+        if(event->kind != COHERENCE_NONE)
         {
-           cout << "_getSize::Not found expected unit(B, KB, MB or GB), invalid input!" << endl;
-           exit(1);
+            _collectStats(chipID, event->core_id, event->kind != COHERENCE_READ_MISS);
+            _clearResult();
         }
         
-    } 
-    else 
+        _popRing(&events[chipID]);
+        _popRing(order);
+        resolved->store(sequence + 1, memory_order_release);
+    }
+}
+
+void Simulator::_drainStages()
+{
+    // every line is resolved and taken by its chip, then the chips run the last effects
+    while(resolved_lines->load(memory_order_acquire) != next_line) {this_thread::yield();};
+    
+    for(int i=0; i<number_of_chips; i++)
     {
-        cout << "_getSize::Not found expected character, invalid input!" << endl;
-        exit(1);
+        while(stage_lines[i].head.load(memory_order_acquire) != stage_lines[i].tail.load(memory_order_relaxed) ||
+              stage_effects[i].head.load(memory_order_acquire) != stage_effects[i].tail.load(memory_order_relaxed)) {this_thread::yield();};
+    }
+    
+    for(int i=0; i<=number_of_chips; i++)
+    {
+        _moveStats(&stages[i]);
+    }
+}
+
+void Simulator::_stopStages()
+{
+    _drainStages();
+    
+    coherence_line done = {0, 0, 0, 0, 0, 1};
+    
+    for(int i=0; i<number_of_chips; i++)
+    {
+        _pushRing(&stage_lines[i], done);
+    }
+    
+    _pushRing(stage_order, -1);
+    
+    for(int i=0; i<=number_of_chips; i++)
+    {
+        stage_workers[i].join();
+    }
+    
+    for(int i=0; i<number_of_chips; i++)
+    {
+        delete[] write_at[i];
     }
     
-    //cout << "_getSize test end" << endl;
+    // the rings of the effects belong to this simulator
+    stages[number_of_chips].effect_rings = NULL;
+    
+    delete[] stages;
+    delete[] stage_workers;
+    delete[] stage_lines;
+    delete[] stage_events;
+    delete[] stage_effects;
+    delete stage_order;
+    delete resolved_lines;
+    delete[] write_at;
     
-    return size;
+    stages = NULL;
 }
 
-obj_time _getTime(const string strLine)
+void Simulator::_printStatsLine(const core_stats *stats)
 {
-    //cout << "_getTime test enter" << endl;
-    string:: size_type pos_start;
-    string:: size_type pos_end;
-       
-    obj_time time;
+    _outputString("reads=");
+    _outputNumber(stats->reads);
+    _outputString(" writes=");
+    _outputNumber(stats->writes);
     
-    if(_getChipID(strLine) == -1) 
+    for(int i=0; i<NUMBER_OF_OPTS; i++)
+    {
+        _outputChar(' ');
+        _outputString(OptTypeNames[i]);
+        _outputChar('=');
+        _outputNumber(stats->counts[i]);
+    }
+    
+    _outputString(" time=");
+    _outputNumber(stats->time);
+    _outputString("ns\n");
+}
+
+void Simulator::openExport(const char *format, const char *fileName)
+{
+    if(strcmp(format, "csv") == 0)
+    {
+        export_type = EXPORT_CSV;
+    }
+    else if(strcmp(format, "jsonl") == 0)
     {
-        pos_start = strLine.find("(");
-        pos_end = strLine.find(")");
+        export_type = EXPORT_JSONL;
+    }
+    else if(strcmp(format, "columnar") == 0)
+    {
+        export_type = EXPORT_COLUMNAR;
     }
     else
     {
-        pos_start = strLine.find(",");
-        pos_end = strLine.find(")");
-        
-        // remove the space before the number
-        while(isspace(strLine.at(pos_start+1))) {pos_start++;};    
+        cout << "_openExport::Not found expected format(csv, jsonl or columnar), invalid input!" << endl;
+        exit(1);
     }
     
-    //cout << "pos_start is " << strLine[pos_start] << endl;
-    //cout << "pos_end is " << strLine[pos_end] << endl;
-       
-    if(pos_start != strLine.npos && pos_end != strLine.npos && pos_start < pos_end) 
+    export_file = fopen(fileName, export_type == EXPORT_COLUMNAR ? "wb" : "w");
+    
+    if(export_file == NULL)
     {
-        string temp = "";
-        
-        if(!isdigit(strLine.at(pos_start+1))) 
+        cout << "_openExport::Can not open " << fileName << "!" << endl;
+        exit(1);
+    }
+    
+    export_buffer = (char *)malloc(EXPORT_BUFFER_SIZE);
+    setvbuf(export_file, export_buffer, _IOFBF, EXPORT_BUFFER_SIZE);
+    
+    if(export_type == EXPORT_CSV)
+    {
+        for(int i=0; i<EXPORT_COLUMNS; i++)
         {
-            cout << "_getTime::Not found expected number, invalid input!" << endl;
-            exit(1);
+            if(i > 0) fputc(',', export_file);
+            fputs(ExportColumnNames[i], export_file);
         }
         
-        // get the number part
-        while(isdigit(strLine.at(++pos_start))) {temp+=strLine.at(pos_start);};
-        time.data = atol(temp.c_str());
+        fputc('\n', export_file);
+    }
+    else if(export_type == EXPORT_COLUMNAR)
+    {
+        // magic, version, number of columns, then each name in 16 bytes
+        uint32_t version = EXPORT_VERSION;
+        uint32_t columns = EXPORT_COLUMNS;
         
-        // remove the space between number and unit
-        while(isspace(strLine.at(pos_start))) {pos_start++;};
+        fwrite(EXPORT_MAGIC, 1, 4, export_file);
+        fwrite(&version, sizeof(version), 1, export_file);
+        fwrite(&columns, sizeof(columns), 1, export_file);
         
-        // get the unit part, like us, ns
-       
-        if(strLine[pos_start] == 'u' && strLine[pos_start+1] == 's' && strLine[pos_start+2] == ')') 
-        {
-           time.unit = us;     
-        } 
-        else if(strLine[pos_start] == 'n' && strLine[pos_start+1] == 's' && strLine[pos_start+2] == ')') 
-        {
-           time.unit = ns; 
-        } 
-        else 
+        for(int i=0; i<EXPORT_COLUMNS; i++)
         {
-           cout << "_getTime::Not found expected unit(us, ns), invalid input!" << endl;
-           exit(1);
+            char name[16] = {0};
+            
+            strncpy(name, ExportColumnNames[i], sizeof(name) - 1);
+            fwrite(name, 1, sizeof(name), export_file);
         }
         
-    } 
-    else 
-    {
-        cout << "_getTime::Not found expected character, invalid input!" << endl;
-        exit(1);
+        export_columns = (unsigned long *)malloc(sizeof(unsigned long) * EXPORT_COLUMNS * EXPORT_BLOCK_ROWS);
     }
+}
+
+void Simulator::_exportAccess(int chipID, int coreID, bool isWrite, unsigned long address, unsigned long loadingPage, int pageSize)
+{
+    unsigned long row[EXPORT_COLUMNS] = {0};
+    
+    row[1] = stats_accesses;
+    row[2] = chipID;
+    row[3] = coreID;
+    row[4] = !isWrite;
+    row[5] = isWrite;
+    row[6] = address;
+    row[7] = loadingPage;
+    row[8] = pageSize;
     
-    //cout << "_getTime test end" << endl;
+    for(int i=0; i<result_index; i++)
+    {
+        opt_time *result = &result_time[result_order[i]];
+        
+        row[9 + result_order[i]] = result->count;
+        row[EXPORT_COLUMNS - 1] += result->time.data * result->count * (result->time.unit == us ? 1000 : 1);
+    }
     
-    return time;
+    _exportRow(row);
 }
 
-int _getNumber(const string strLine, bool isRW)
+void Simulator::_exportRow(const unsigned long row[])
 {
-    //cout << "_getNumber test enter" << endl; 
-    string:: size_type pos_start;
-    string:: size_type pos_end;
-       
-    int data;
-    
-    if(isRW)
+    switch(export_type)
     {
-        if(_getChipID(strLine) == -1) 
-        {
-            pos_start = strLine.find("(");
-            pos_end = strLine.find(",");
-        }
-        else
-        {
-            pos_start = strLine.find(",");
-            pos_end = strLine.find(",", pos_start+1);
+        case EXPORT_CSV:
+            fputs(ExportKindNames[row[0]], export_file);
+            
+            for(int i=1; i<EXPORT_COLUMNS; i++)
+            {
+                fputc(',', export_file);
+                _writeNumber(export_file, row[i]);
+            }
+            
+            fputc('\n', export_file);
+            break;
+        
+        case EXPORT_JSONL:
+            fputs("{\"kind\":\"", export_file);
+            fputs(ExportKindNames[row[0]], export_file);
+            fputc('"', export_file);
+            
+            for(int i=1; i<EXPORT_COLUMNS; i++)
+            {
+                fputs(",\"", export_file);
+                fputs(ExportColumnNames[i], export_file);
+                fputs("\":", export_file);
+                _writeNumber(export_file, row[i]);
+            }
+            
+            fputs("}\n", export_file);
+            break;
+        
+        default:
+            // keep each column together in the block
+            for(int i=0; i<EXPORT_COLUMNS; i++)
+            {
+                export_columns[i * EXPORT_BLOCK_ROWS + export_rows] = row[i];
+            }
             
-            // remove the space before the number
-            while(isspace(strLine.at(pos_start+1))) {pos_start++;};    
-        }    
+            export_rows++;
+            
+            if(export_rows == EXPORT_BLOCK_ROWS)
+            {
+                _exportBlock();
+            }
+            break;
     }
-    else
+}
+
+void Simulator::_exportBlock()
+{
+    // the number of rows, then each column of these rows
+    uint32_t rows = export_rows;
+    uint32_t reserved = 0;
+    
+    fwrite(&rows, sizeof(rows), 1, export_file);
+    fwrite(&reserved, sizeof(reserved), 1, export_file);
+    
+    for(int i=0; i<EXPORT_COLUMNS; i++)
     {
-        if(_getChipID(strLine) == -1) 
+        for(int j=0; j<export_rows; j++)
         {
-            pos_start = strLine.find("(");
-            pos_end = strLine.find(")");
-        }
-        else
-        {
-            pos_start = strLine.find(",");
-            pos_end = strLine.find(")");
+            uint64_t value = export_columns[i * EXPORT_BLOCK_ROWS + j];
             
-            // remove the space before the number
-            while(isspace(strLine.at(pos_start+1))) {pos_start++;};    
+            fwrite(&value, sizeof(value), 1, export_file);
         }
     }
-   
-    //cout << "pos_start is " << strLine[pos_start] << endl;
-    //cout << "pos_end is " << strLine[pos_end] << endl;
     
-    if(pos_start != strLine.npos && pos_end != strLine.npos && pos_start < pos_end) 
+    export_rows = 0;
+}
+
+void Simulator::closeExport()
+{
+    // the counters of each core
+    for(int i=0; chip_stats != NULL && i<number_of_chips; i++)
     {
-        string temp = "";
-        
-        if(!isdigit(strLine.at(pos_start+1))) 
-        {
-            cout << "_getNumber::Not found expected number, invalid input!" << endl;
-            exit(1);
-        }
-        
-        // get the number part
-        while(isdigit(strLine.at(++pos_start))) {temp+=strLine.at(pos_start);};
-        data = atol(temp.c_str());
-        
-        if(isRW)
+        for(int j=0; j<stats_cores[i]; j++)
         {
-            if(strLine[pos_start] != ',') 
-            {
-               cout << "_getNumber::Not found expected ',', invalid input!" << endl;
-               exit(1);
-            }    
-        }
-        else
-        {
-            if(strLine[pos_start] != ')') 
+            core_stats *stats = &chip_stats[i][j];
+            unsigned long row[EXPORT_COLUMNS] = {0};
+            
+            row[0] = 1;
+            row[2] = i;
+            row[3] = j;
+            row[4] = stats->reads;
+            row[5] = stats->writes;
+            
+            for(int k=0; k<NUMBER_OF_OPTS; k++)
             {
-               cout << "_getNumber::Not found expected ')', invalid input!" << endl;
-               exit(1);
+                row[9 + k] = stats->counts[k];
             }
+            
+            row[EXPORT_COLUMNS - 1] = stats->time;
+            _exportRow(row);
         }
-    } 
-    else 
+    }
+    
+    if(export_type == EXPORT_COLUMNAR)
+    {
+        // the last block, then a block of 0 rows as the end
+        if(export_rows > 0) _exportBlock();
+        _exportBlock();
+        free(export_columns);
+    }
+    
+    if(ferror(export_file) || fclose(export_file) != 0)
     {
-        cout << "_getNumber::Not found expected character, invalid input!" << endl;
+        cout << "_closeExport::Failed to write the export file!" << endl;
         exit(1);
     }
     
-    //cout << "_getNumber test end" << endl;
+    free(export_buffer);
+    export_file = NULL;
+}
+
+void Simulator::_echoLine(const char *line, const char *end)
+{
+    if(quiet_output) return;
     
-    return data;
+    _outputText(line, end - line);
+    _outputChar('\n');
 }
 
-string _getAddress(const string strLine)
+void Simulator::_readFromCacheL2(int chipID, int coreID, int tlbIndex)
 {
-    //cout << "_getAddress test enter" << endl;
-    string:: size_type pos_start;
-    string:: size_type pos_end;
-       
-    string data;
+    chip *currentChip = &array_chips[chipID];
     
-    if(_getChipID(strLine) == -1) 
+    unsigned long long line = currentChip->tlb_l2[tlbIndex];
+              
+    if(_getLineOwner(line) != coreID)
     {
-        // if not chipID input, address is between the first "," and the second ","
-        pos_start = strLine.find(",");
-        pos_end = strLine.find(",", pos_start+1);
+      if(_getLineState(line) == 'M')
+      {
+          _addResultTime(OPT_L2WRITEBACK, memory_access_speed);
+      }
+      
+      line = _setLineOwner(line, coreID);
+      line = _setLineState(line, 'S');
     }
     else
-    {   
-        // if not chipID input, address is between the second "," and the third ","
-        pos_start = strLine.find(",");
-        pos_start = strLine.find(",", pos_start+1);
-        pos_end = strLine.find(",", pos_start+1);
+    {
+      if(_getLineState(line) == 'M')
+      {
+          line = _setLineState(line, 'E');
+          //_addResultTime(OPT_L2WRITEBACK, memory_access_speed);
+      }
     }
     
-    //cout << "pos_start is " << strLine[pos_start] << endl;
-    //cout << "pos_end is " << strLine[pos_end] << endl;
+    currentChip->tlb_l2[tlbIndex] = line;
+    _rememberLineL2(chipID, coreID, tlbIndex);
     
-    // start from the next of ","
-    pos_start++;
+    _addLineResult(result_l2, tlbIndex, _getLineState(line));
     
-    // remove the space before the number
-    while(isspace(strLine.at(pos_start))) {pos_start++;};     
-   
-    if(pos_start != string::npos && pos_end != string::npos && pos_start < pos_end) 
-    {
-        data = strLine.substr(pos_start, pos_end - pos_start);   
-    } 
-    else 
+    _addResultTime(OPT_L2READ, currentChip->cache_access_speed_l2);
+    
+    // move it to the end, preparing for LRU
+    _swapTLBByLRU(chipID, tlbIndex);   
+}
+
+void Simulator::_readFromCacheL3(int chipID, int coreID, int tblIndex)
+{
+    unsigned long long line = tlb_l3[tblIndex];
+                   
+    // check if it is shared, if yes, call broadcast
+    if(_getLineOwner(line) != chipID * 10 + coreID)
     {
-        cout << "_getAddress::Not found expected character, invalid input!" << endl;
-        exit(1);
+      line = _setLineOwner(line, chipID * 10 + coreID);
+      line = _setLineState(line, 'S');
+      tlb_l3[tblIndex] = line;
     }
     
-    //cout << "_getAddress test end" << endl;
+    _addLineResult(result_l3, tblIndex, _getLineState(line));
+       
+    _addResultTime(OPT_L3READ, cache_access_speed_l3);
     
-    return data;
+    // move it to the end, preparing for LRU
+    _swapTLBL3ByLRU(tblIndex);
 }
 
-int _getChipID(const string strLine)
-{    
-    //cout << "_getChipID test enter" << endl; 
-    string:: size_type pos_start;
-    string:: size_type pos_end;
+void Simulator::_loadMemToCacheL2(int chipID, int coreID, unsigned long loadingPage)
+{
+    PROFILE_SCOPE(PROFILE_LOAD_L2);
     
-    // return value;   
-    int data;
+    chip *currentChip = &array_chips[chipID];
+    int setIndex = loadingPage % currentChip->number_of_sets_l2;
     
-    pos_start = strLine.find(")");
-    pos_end = strLine.find(",");
+    int availableBlock = _findAvailableBlockInCacheL2(chipID, setIndex);
+                   
+    //cout << "availableBlock in L2 is " << availableBlock << endl;
     
-    // find ",", if not find, return -1, means no input chip ID
-    // if "," is behind ")", return -1, means no input chip ID
-    if(pos_end == string::npos || pos_end > pos_start)
+    // not -1, means there is empty block, use it
+    // or it is full, call take out
+    if(availableBlock != -1)
     {
-        //cout << "_getChipID test1" << endl;       
-        return -1;
+       // add into TLB and mark it as used        
+       currentChip->tlb_l2[availableBlock] = _makeLine(loadingPage, coreID, 'E');
+       _addPageToIndex(&currentChip->index_l2, loadingPage, availableBlock);
+       _swapTLBByLRU(chipID, availableBlock);
+       _rememberLineL2(chipID, coreID, availableBlock);
+       
+       _addLineResult(result_l2, availableBlock, 'E');
+       
+       // add memory loading time
+       _addResultTime(OPT_MEMREAD, memory_access_speed);
+       
+       // add L2 read time
+       _addResultTime(OPT_L2READ, currentChip->cache_access_speed_l2);
+       
     }
     else
     {
-        // if find ",", count the number of ",", if result is 2, return -1
-        // means no input chip ID for read and write
-        int count=0;
-        //pos_start = strLine.find(")");
-        
-        while(pos_end != string::npos && pos_start != string::npos)
-        {
-            count++;
-            pos_end = strLine.find(",", pos_end+1);
-            if(pos_end > pos_start) {break;}
-        }
-        
-        if(count == 2)
-        {
-            //cout << "_getChipID test2" << endl; 
-            return -1;
-        }
+       // take the first one out by LRU
+       int oldBlock = _takeTheFirstOutByLRU(chipID, setIndex);
+       char oldState = _getLineState(currentChip->tlb_l2[oldBlock]);
+       
+       // add into TLB and mark it as used
+       currentChip->tlb_l2[oldBlock] = _makeLine(loadingPage, coreID, 'E');
+       _addPageToIndex(&currentChip->index_l2, loadingPage, oldBlock);
+       _swapTLBByLRU(chipID, oldBlock);
+       _rememberLineL2(chipID, coreID, oldBlock);
+       
+       _addLineResult(result_l2, oldBlock, 'E');
+       
+       // add times
+       _addResultTime(OPT_REPLACE, replacement_speed);
+       
+       if(oldState == 'M')
+       {
+           _addResultTime(OPT_L2WRITEBACK, memory_access_speed);
+       }
+       
+       _addResultTime(OPT_MEMREAD, memory_access_speed);
         
+       _addResultTime(OPT_L2READ, currentChip->cache_access_speed_l2);
     }
+}
+
+void Simulator::_writeToCacheL3(int chipID, int coreID, unsigned long loadingPage, bool isRead)
+{
+    PROFILE_SCOPE(PROFILE_WRITE_L3);
+    
+    int setIndex = loadingPage % number_of_sets_l3;
+    int availableBlock = _findAvailableBlockInCacheL3(setIndex);
     
-    // if get here, means input chip ID, then try to get it
-    pos_start = strLine.find("(");
-    pos_end = strLine.find(",");
-   
-    if(pos_start != strLine.npos && pos_end != strLine.npos && pos_start < pos_end) 
+    // set state
+    char state = isRead ? 'E' : 'M';
+    
+    // not -1, means there is empty block, use it
+    // or it is full, call take out               
+    if(availableBlock != -1)
     {
-        string temp = "";
-        
-        if(!isdigit(strLine.at(pos_start+1))) 
-        {
-            cout << "_getChipID::Not found expected number, invalid input!" << endl;
-            exit(1);
-        }
-        
-        // get the number part
-        while(isdigit(strLine.at(++pos_start))) {temp+=strLine.at(pos_start);};
-        data = atol(temp.c_str());
-        
-        if(strLine[pos_start] != ',') 
-        {
-           cout << "_getChipID::Not found expected ',', invalid input!" << endl;
-           exit(1);
-        }
-        
-    } 
+       // add into TLB and mark it as used
+       tlb_l3[availableBlock] = _makeLine(loadingPage, chipID * 10 + coreID, state);
+       _addPageToIndex(index_l3, loadingPage, availableBlock);
+       _swapTLBL3ByLRU(availableBlock);
+       
+       _addLineResult(result_l3, availableBlock, state);
+       
+       // add write time
+       _addResultTime(OPT_L3WRITE, cache_access_speed_l3);   
+    }
+    else
+    {
+       // take the first one out by LRU
+       int oldBlock = _takeTheFirstOutL3ByLRU(setIndex);
+       unsigned long long oldLine = tlb_l3[oldBlock];
+       char oldState = _getLineState(oldLine);
+       
+       // add into TLB, it keeps the owner unless the old one is shared
+       tlb_l3[oldBlock] = _makeLine(loadingPage, _getLineOwner(oldLine), state);
+       _addPageToIndex(index_l3, loadingPage, oldBlock);
+       _swapTLBL3ByLRU(oldBlock);
+       
+       _addLineResult(result_l3, oldBlock, state);
+       
+       _addResultTime(OPT_REPLACE, replacement_speed);
+       
+       if(oldState == 'M')
+       {
+           _addResultTime(OPT_L3WRITEBACK, memory_access_speed);
+       }
+       
+       if(oldState == 'M' || oldState == 'S')
+       {
+           tlb_l3[oldBlock] = _setLineOwner(tlb_l3[oldBlock], chipID * 10 + coreID);
+           _addResultTime(OPT_BROADCAST, broadcast_speed);
+       } 
+    }
+}
+
+void Simulator::_writeToCacheL2(int chipID, int coreID, unsigned long loadingPage)
+{
+    PROFILE_SCOPE(PROFILE_WRITE_L2);
+    
+    chip *currentChip = &array_chips[chipID];
+    int setIndex = loadingPage % currentChip->number_of_sets_l2;
+    
+    int availableBlock = _findAvailableBlockInCacheL2(chipID, setIndex);
+           
+    //cout << "availableBlock is " << availableBlock << endl;
+    
+    // not -1, means there is empty block, use it
+    // or it is full, call take out 
+    if(availableBlock != -1)
+    {
+       // add into TLB and mark it as used
+       currentChip->tlb_l2[availableBlock] = _makeLine(loadingPage, coreID, 'M');
+       _addPageToIndex(&currentChip->index_l2, loadingPage, availableBlock);
+       _swapTLBByLRU(chipID, availableBlock);
+       _rememberLineL2(chipID, coreID, availableBlock);
+       
+       _addLineResult(result_l2, availableBlock, 'M');
+       
+       // add write time
+       _addResultTime(OPT_L2WRITE, currentChip->cache_access_speed_l2);
+    }
     else
     {
-         cout << "_getChipID::Invalid input!" << endl;
-         exit(1);
+       // take the first one out by LRU
+       int oldBlock = _takeTheFirstOutByLRU(chipID, setIndex);
+       char oldState = _getLineState(currentChip->tlb_l2[oldBlock]);
+       
+       // add into TLB and mark as used by me
+       currentChip->tlb_l2[oldBlock] = _makeLine(loadingPage, coreID, 'M');
+       _addPageToIndex(&currentChip->index_l2, loadingPage, oldBlock);
+       _swapTLBByLRU(chipID, oldBlock);
+       _rememberLineL2(chipID, coreID, oldBlock);
+       
+       _addLineResult(result_l2, oldBlock, 'M');
+       
+       // check if it is shared, if yes, call broadcast
+       if(oldState == 'S')
+       {      
+           _addResultTime(OPT_BROADCAST, broadcast_speed);
+       }
+       
+       _addResultTime(OPT_REPLACE, replacement_speed);
+            
+       _addResultTime(OPT_L2WRITE, currentChip->cache_access_speed_l2);
     }
-    
-    //cout << "_getChipID test end" << endl;
-     
-    //cout << "chip ID=" << data << endl;
-    return data;
 }
 
-void _checkValidInput(string strLine)
+void Simulator::_rewriteToCacheL2(int chipID, int coreID, int tlbIndex)
 {
-    string:: size_type pos_start;
-    string:: size_type pos_end;
+    PROFILE_SCOPE(PROFILE_WRITE_L2);
     
-    pos_start = strLine.find("(");
-    
-    if(pos_start == strLine.npos)
-    {
-        cout << "_checkValidInput::Not found expected '(', invalid input!" << endl;
-        exit(1); 
+    chip *currentChip = &array_chips[chipID];
+    unsigned long long line = currentChip->tlb_l2[tlbIndex];
+           
+    // check if it is shared, if yes, call broadcast
+    if(_getLineState(line) == 'S')
+    {                                          
+      _addResultTime(OPT_BROADCAST, broadcast_speed);
     }
     
-    for(int i=0; i<pos_start; i++)
-    {
-        if(!isalpha(strLine[i]))
-        {
-            cout << "_checkValidInput::Invalid function name!" << endl;
-            exit(1);
-        }
-    }
+    // mark as used by me
+    currentChip->tlb_l2[tlbIndex] = _setLineState(_setLineOwner(line, coreID), 'M');
+    _rememberLineL2(chipID, coreID, tlbIndex);
     
-    pos_end = strLine.find(")");
+    _addLineResult(result_l2, tlbIndex, 'M');
     
-    if(pos_end == strLine.npos)
-    {
-        cout << "_checkValidInput::Not found expected ')', invalid input!" << endl;
-        exit(1); 
-    }
+    _addResultTime(OPT_L2WRITE, currentChip->cache_access_speed_l2);
     
-    if(pos_start > pos_end)
-    {
-        cout << "_checkValidInput::')' is before '(', invalid input!" << endl;
-        exit(1);
-    }
+    // move it to the end, preparing for LRU
+    _swapTLBByLRU(chipID, tlbIndex);
 }
 
-unsigned long _caculateTotalBlocks(obj_size size)
+void Simulator::_rewriteToCacheL3(int chipID, int coreID, int tlbIndex, unsigned long loadingPage)
 {
-    unsigned long total_block;
+    PROFILE_SCOPE(PROFILE_WRITE_L3);
     
-    if(size.unit < cache_line_size.unit) 
-    {
-        cout << "Cache line size is bigger than memory or cache size, invalid input!" << endl;
-        exit(1);
-    } 
-    else 
+    unsigned long long line = tlb_l3[tlbIndex];
+           
+    // check if it is shared, if yes, call broadcast
+    if(_getLineState(line) == 'M' || _getLineState(line) == 'S')
     {
-        int step = size.unit - cache_line_size.unit;
-        total_block = (long)(size.data * pow(2,step*10)/cache_line_size.data);
+      // mark other L2 as invalid
+      _invalidateLineL2(_getLineOwner(line)/10, loadingPage);
+      
+      // mark as used by me
+      line = _setLineOwner(line, chipID * 10 + coreID);
+      _addResultTime(OPT_BROADCAST, broadcast_speed);
     }
     
-    return total_block;
-}
-
-unsigned long _caculateNeedBlocks(unsigned long address, obj_size size)
-{
-    unsigned long need_blocks;
-    
-    int modulo = address % cache_line_size.data;
+    tlb_l3[tlbIndex] = _setLineState(line, 'M');
     
-    if(modulo != 0)
-    {
-        if(size.unit < cache_line_size.unit) 
-        {
-            need_blocks = 1;
-        }
-        else
-        {
-            int step = size.unit - cache_line_size.unit;
-            unsigned long temp1 = address / cache_line_size.data;
-            unsigned long temp2 = (long)((address + size.data * pow(2,step*10)) / cache_line_size.data);
-            need_blocks = temp2 - temp1 + 1; 
-        }                   
-    }
-    else 
-    {
-        if(size.unit < cache_line_size.unit) 
-        {
-            need_blocks = 1;
-        } 
-        else 
-        {
-            int step = size.unit - cache_line_size.unit;
-            need_blocks = (long)(size.data * pow(2,step*10)/cache_line_size.data);
-            modulo = (long)(size.data * pow(2,step*10))%cache_line_size.data;
-            
-            if(modulo != 0)
-            {
-                need_blocks++;
-            }
-        }
-    }
+    _addLineResult(result_l3, tlbIndex, 'M');
+       
+    _addResultTime(OPT_L3WRITE, cache_access_speed_l3);
     
-    return need_blocks;
+    // move it to the end, preparing for LRU
+    _swapTLBL3ByLRU(tlbIndex);
 }
 
-int _checkCacheL2(int chipID, unsigned long loadingPage, bool isAddTime)
+void Simulator::_invalidateLineL2(int chipID, unsigned long loadingPage)
 {
-    int r = -1;
-    chip currentChip = array_chips[chipID];
-    int tlbLength = currentChip.total_block_l2;
+    PROFILE_SCOPE(PROFILE_INVALIDATE);
     
-    for(int i=0; i<tlbLength; i++)
+    // the L3 stage has no L2, the chip invalidates it before its next line of that set
+    if(effect_rings != NULL)
     {
-        if(currentChip.tlb_l2[i].memory_page == loadingPage && currentChip.tlb_l2[i].valid == 1)
-        {
-            r = i;
-            break;
-        }
+        coherence_event effect = {loadingPage, 0, COHERENCE_INVALIDATE};
+        
+        _pushRing(&effect_rings[chipID], effect);
+        return;
     }
     
-    if(isAddTime)
+    int tlbIndex = _checkCacheL2(chipID, loadingPage, 0);
+    
+    // the other L2 may have replaced it already
+    if(tlbIndex != -1)
     {
-        string opt="";
-        
-        if(r != -1)
-        {
-            opt = "L2hit";    
-        }
-        else
-        {
-            opt = "L2miss";
-        }
+        unsigned long long *line = &array_chips[chipID].tlb_l2[tlbIndex];
         
-        _addResultTime(opt, currentChip.cache_access_speed_l2);
+        *line = _setLineState(*line & ~LINE_VALID, 'I');
+        _removePageFromIndex(&array_chips[chipID].index_l2, loadingPage);
+        _forgetLineL2(chipID, tlbIndex);
     }
-        
-    return r;
 }
 
-int _checkCacheL3(int chipID, unsigned long loadingPage, bool isAddTime)
+const char *Simulator::_checkCommand(const command *cmd)
 {
-    int r = -1;
+    PROFILE_SCOPE(PROFILE_VALIDATE);
+    
+    const char *noMemory = "Not input memory size, it must be the first command!";
     
-    for(int i=0; i<total_block_l3; i++)
+    // the shards and stages are set up by the configuration at the first read or write
+    if((shards != NULL || stages != NULL) && cmd->type < CMD_READ)
     {
-        if(tlb_l3[i].memory_page == loadingPage)
-        {
-            r = i;
-            break;
-        }
+        return "runCommand::Configuration after the first read or write can not run on multiple threads, invalid input!";
     }
     
-    if(isAddTime)
+    // the order of the commands
+    switch(cmd->type)
     {
-        string opt="";
+        case CMD_MEMORY_SIZE:
+            break;
         
-        if(r != -1)
-        {
-            opt = "L3hit";    
-        }
-        else
-        {
-            opt = "L3miss";
-        }
+        case CMD_NUM_OF_CHIPS:
+            if(!commands[0]) return noMemory;
+            if(commands[2]) return "Input error, this must be the second command!";
+            // core 0 of the last chip must fit the owner bits, numOfCores checks the last core
+            if(cmd->number < 1 || (cmd->number - 1) * 10L > (long)(LINE_OWNER_MASK >> LINE_OWNER_SHIFT)) return "Invalid number of chips, please input again!";
+            break;
         
-        _addResultTime(opt, cache_access_speed_l3);
-    }
+        case CMD_NUM_OF_CORES:
+            if(!commands[0]) return noMemory;
+            if(cmd->number < 1) return "Invalid number of cores, please input again!";
+            break;
         
-    return r;
-}
-
-void _addResultTime(string opt, obj_time time)
-{
-    for(int i=0; i<result_index; i++)
-    {
-        if(result_time[i].opt == opt)
+        case CMD_CACHE_LINE_SIZE:
+        case CMD_CACHE_SIZE:
+        case CMD_CACHE_ACCESS_SPEED:
+        case CMD_REPLACEMENT_SPEED:
+        case CMD_BROADCAST_SPEED:
+        case CMD_MEMORY_ACCESS_SPEED:
+            if(!commands[0] || !commands[2]) return noMemory;
+            break;
+        
+        case CMD_CACHE_ASSOCIATIVITY:
+            if(!commands[4]) return "Not input cache size, it must be before cacheAssociativity!";
+            break;
+        
+        case CMD_READ:
+        case CMD_WRITE:
         {
-            result_time[i].count++;
-            return;
+            const char *error = _checkCommandsReady();
+            
+            // an address out of memory is ignored before its IDs are checked
+            if(error != NULL || cmd->address/cache_line_size.data > memory_pages) return error;
+            
+            return _checkValidIDs(cmd->chip_id == -1 ? 0 : cmd->chip_id, cmd->number);
         }
+        
+        default:
+            return NULL;
     }
     
-    result_time[result_index].opt = opt;        
-    result_time[result_index].time = time;
-    result_time[result_index].count = 1;
-    result_index++;
-}
-
-int _findAvailableBlockInCacheL2(int chipID)
-{
-    int availableBlock = -1;
-    chip currentChip = array_chips[chipID];
-    
-    for(int i=0; i<currentChip.total_block_l2; i++)
+    // a chip ID of the configuration is a chip, or -1 for no chip ID
+    if(cmd->chip_id >= number_of_chips || cmd->chip_id < -1)
     {
-        if(currentChip.array_usage_l2[i] == -1)
-        {
-            availableBlock = i;
-            break;
-        }
+        return "Invalid chip ID, please input again!";
     }
     
-    return availableBlock;
-}
-
-int _findAvailableBlockInCacheL3()
-{
-    int availableBlock = -1;
-    
-    for(int i=0; i<total_block_l3; i++)
+    // the owner of a line in L3 is chip ID * 10 + core ID, the last core of the last chip must fit the owner bits
+    if(cmd->type == CMD_NUM_OF_CORES && 
+       (cmd->chip_id == -1 ? number_of_chips - 1 : cmd->chip_id) * 10L + cmd->number - 1 > (long)(LINE_OWNER_MASK >> LINE_OWNER_SHIFT))
     {
-        if(array_usage_l3[i] == -1)
-        {
-            availableBlock = i;
-            break;
-        }
+        return "Too many cores to own a line, invalid input!";
     }
     
-    return availableBlock;
-}
-
-entry _takeTheFirstOutByLRU(int chipID)
-{ 
-    chip currentChip = array_chips[chipID];
-    entry oldEntry = currentChip.tlb_l2[0];
-    
-    for(int i=0; i<currentChip.total_block_l2-1; i++)
+    // a size of 0 or an unknown unit would leave no lines to divide by
+    if((cmd->type == CMD_MEMORY_SIZE || cmd->type == CMD_CACHE_LINE_SIZE || cmd->type == CMD_CACHE_SIZE) && 
+       (cmd->size.data == 0 || cmd->size.unit < B || cmd->size.unit > GB))
     {
-        currentChip.tlb_l2[i] = currentChip.tlb_l2[i+1];       
+        return "Size is 0 or its unit is not B, KB, MB or GB, invalid input!";
     }
     
-    return oldEntry;
-}
-
-entry _takeTheFirstOutL3ByLRU()
-{ 
-    entry oldEntry = tlb_l3[0];
-    
-    for(int i=0; i<total_block_l3-1; i++)
+    // the memory and caches have at least one line
+    if(cmd->type == CMD_CACHE_LINE_SIZE && cmd->size.unit > memory_size.unit)
     {
-        tlb_l3[i] = tlb_l3[i+1];       
+        return "Cache line size is bigger than memory or cache size, invalid input!";
     }
     
-    return oldEntry;
-}
-
-void _swapTLBByLRU(int chipID, int target, int source)
-{
-    chip currentChip = array_chips[chipID];
-    
-    entry temp = currentChip.tlb_l2[target];
-    
-    for(int i=target; i<source; i++)
+    // a line keeps the page in LINE_PAGE_MASK bits, more pages would share their tags
+    if(cmd->type == CMD_CACHE_LINE_SIZE && memory_size.data * pow(2,(memory_size.unit - cmd->size.unit)*10) / cmd->size.data > LINE_PAGE_MASK)
     {
-        currentChip.tlb_l2[i] = currentChip.tlb_l2[i+1];
+        return "Memory has too many pages of this cache line size, invalid input!";
     }
     
-    currentChip.tlb_l2[source] = temp;
-    
-    //// print TLB
-//    for(int i=0; i<currentChip.total_block_l2; i++)
-//    {
-//        cout << "TLB loadingPage is " << currentChip.tlb_l2[i].memory_page
-//        << ", block ID is " << currentChip.tlb_l2[i].block_id << endl;    
-//    }
-    
-}
-
-void _swapTLBL3ByLRU(int target, int source)
-{
-    entry temp = tlb_l3[target];
-    
-    for(int i=target; i<source; i++)
+    if(cmd->type == CMD_CACHE_SIZE && (cache_line_size.unit > cmd->size.unit || 
+                                       (cache_line_size.unit == cmd->size.unit && cache_line_size.data > cmd->size.data)))
     {
-        tlb_l3[i] = tlb_l3[i+1];
+        return "_checkValidInput::CacheLineSize is bigger than CacheSize, invalid input!";
     }
     
-    tlb_l3[source] = temp;
-}
-
-int _getTLBL2UsedBlocks(int chipID)
-{
-    chip currentChip = array_chips[chipID];
-    int number = 0;
-    
-    for(int i=0; i< currentChip.total_block_l2; i++)
+    // the ways divide the blocks of the cache, no chip ID is L3 for multiple chips
+    if(cmd->type == CMD_CACHE_ASSOCIATIVITY)
     {
-        if(currentChip.tlb_l2[i].block_id != -1)
+        bool isL3 = cmd->chip_id == -1 && number_of_chips > 1;
+        unsigned long blocks = isL3 ? total_block_l3 : array_chips[cmd->chip_id == -1 ? 0 : cmd->chip_id].total_block_l2;
+        
+        if(blocks == 0)
         {
-            number++;
+            snprintf(error_text, sizeof(error_text), "cacheAssociativity::Not input cache size of %s, it must be before cacheAssociativity!", isL3 ? "L3" : "L2");
+            return error_text;
         }
-        else
+        
+        // the lines already cached are in the LRU order of the old sets
+        if(stats_accesses > 0)
         {
-            break;
+            return "cacheAssociativity::Caches can not be split after the first read or write, invalid input!";
+        }
+        
+        if(cmd->number < 1 || blocks % cmd->number != 0)
+        {
+            snprintf(error_text, sizeof(error_text), "cacheAssociativity::%s blocks can not be divided into %d ways, invalid input!", 
+                     isL3 ? "L3" : "L2", cmd->number);
+            return error_text;
         }
     }
     
-    return number;
+    return NULL;
 }
 
-int _getTLBL3UsedBlocks()
+const char *Simulator::_checkCommandsReady()
 {
-    int number = 0;
-    
-    for(int i=0; i< total_block_l3; i++)
+     PROFILE_SCOPE(PROFILE_VALIDATE);
+     
+     for(int i=2; i<9; i++)
+     {
+         if(!commands[i])
+         {
+             snprintf(error_text, sizeof(error_text), "Missing command:%s for reading and writing, please input again!", funcNames[i].c_str());
+             return error_text;
+         }
+     }
+     
+     return NULL;
+}
+
+void Simulator::_freeChips()
+{
+    for(int i=0; array_chips != NULL && i<number_of_chips; i++)
     {
-        if(tlb_l3[i].block_id != -1)
-        {
-            number++;
-        }
-        else
-        {
-            break;
-        }
+        delete[] array_chips[i].tlb_l2;
+        _freePageIndex(&array_chips[i].index_l2);
+        _freeLRUList(&array_chips[i].lru_l2);
+        _freeBlockBitmap(&array_chips[i].bitmap_l2);
+        delete[] array_chips[i].memo_page;
+        delete[] array_chips[i].memo_block;
     }
     
-    return number;
+    delete[] array_chips;
+    array_chips = NULL;
+}
+
+const char *Simulator::_checkValidIDs(int chipID, int coreID)
+{     
+     PROFILE_SCOPE(PROFILE_VALIDATE);
+     
+     if(chipID >= number_of_chips || chipID < -1)
+     {
+         return "Invalid chip ID, please input again!";
+     }
+     
+     if(coreID >= array_chips[chipID].number_of_core || coreID < 0)
+     {
+         return "Invalid core ID, please input again!";
+     }
+     
+     // the lines of a chip always go through its L2
+     if(array_chips[chipID].total_block_l2 == 0)
+     {
+         snprintf(error_text, sizeof(error_text), "Not input cache size of L2 of chip %d, it must be before read and write!", chipID);
+         return error_text;
+     }
+     
+     return NULL;
 }
 
-void _printResult(int chipID, int pages[], int pageSize)
+void _initLineResult(line_result *result)
 {
-    chip currentChip = array_chips[chipID];
-    
-    //// print TLB
-//    for(int i=0; i<currentChip.total_block_l2; i++)
-//    {
-//        cout << "TLB loadingPage is " << currentChip.tlb_l2[i].memory_page
-//        << ", block ID is " << currentChip.tlb_l2[i].block_id << endl;    
-//    }
-    
-    //// print L2 usage
-//    for(int i=0; i<currentChip.total_block_l2; i++)
-//    {
-//        cout << "L2 usage is " << currentChip.array_usage_l2[i] << endl;
-//    }
-    
-//    // print L2 usage
-//    for(int i=0; i<total_block_l3; i++)
-//    {
-//        cout << "L3 usage is " << array_usage_l3[i] << endl;
-//    }
+    result->capacity = 1024;
+    result->length = 0;
+    result->block = new int[result->capacity];
+    result->state = new char[result->capacity];
+}
 
-    // print block id and state
-    char temp[10];
-    obj_time totalTime={0,ns};
-     
-    cout << "L2idx=" << l2ID.substr(0, l2ID.length()-1);
-    
-    if(number_of_chips > 1)
-    {
-        cout << " L3idx=" << l3ID.substr(0, l3ID.length()-1);
-    }
-    
-    // print time
-    cout << " time(";
-    
-    for(int i=0; i<result_index; i++)
+void _addLineResult(line_result *result, int blockID, char state)
+{
+    // only grows when one read or write uses more lines than ever before
+    if(result->length == result->capacity)
     {
-        totalTime.data += result_time[i].time.data * result_time[i].count;
-        totalTime.unit = result_time[i].time.unit;
+        int *block = new int[result->capacity * 2];
+        char *stateArray = new char[result->capacity * 2];
         
-        cout << result_time[i].opt << "=" << result_time[i].time.data 
-        << UnitTimeNames[result_time[i].time.unit];
+        for(int i=0; i<result->length; i++)
+        {
+            block[i] = result->block[i];
+            stateArray[i] = result->state[i];
+        }
         
-        if(result_time[i].count > 1) cout << "*" << result_time[i].count;
-        cout << ", ";
+        delete[] result->block;
+        delete[] result->state;
+        
+        result->block = block;
+        result->state = stateArray;
+        result->capacity *= 2;
     }
     
-    cout << "total=" << totalTime.data << UnitTimeNames[totalTime.unit] << ")";
-    
-    result_index = 0;
+    result->block[result->length] = blockID;
+    result->state[result->length] = state;
+    result->length++;
+}
+
+void Simulator::_outputString(const char *str)
+{
+    if(output == NULL) return;
     
-    if(number_of_chips > 1)
-    {
-        cout << " L2state=" << l2State.substr(0, l2State.length()-1) 
-             << " L3state=" << l3State.substr(0, l3State.length()-1) << endl;
-    }
-    else
+    if(output_ring != NULL)
     {
-        cout << " state=" << l2State.substr(0, l2State.length()-1) << endl;
+        _pushOutput(OUTPUT_STRING, str, 0, 0);
+        return;
     }
     
-    cout << endl;
-    
-    l2ID = "";
-    l2State = "";
-    l3ID = "";
-    l3State = "";
+    fputs(str, output);
 }
 
-void _readFromCacheL2(int chipID, int coreID, int tlbIndex)
+void Simulator::_outputText(const char *str, size_t length)
 {
-    chip currentChip = array_chips[chipID];
+    if(output == NULL) return;
     
-    int blockID = currentChip.tlb_l2[tlbIndex].block_id;
-              
-    if(currentChip.array_usage_l2[blockID] != coreID)
-    {
-      if(currentChip.tlb_l2[tlbIndex].state == 'M')
-      {
-          _addResultTime("L2writeback", memory_access_speed);
-      }
-      
-      currentChip.array_usage_l2[blockID] = coreID;                                    
-      currentChip.tlb_l2[tlbIndex].state = 'S';                                       
-    }
-    else
+    if(output_ring != NULL)
     {
-      if(currentChip.tlb_l2[tlbIndex].state == 'M')
-      {
-          currentChip.tlb_l2[tlbIndex].state = 'E';
-          //_addResultTime("L2writeback", memory_access_speed);
-      }
+        _pushOutput(OUTPUT_TEXT, str, length, 0);
+        return;
     }
     
-    l2ID += _num2str(blockID);
-    l2ID += "&";
-    l2State += currentChip.tlb_l2[tlbIndex].state;
-    l2State += "&";
+    fwrite(str, 1, length, output);
+}
+
+void Simulator::_outputChar(char c)
+{
+    if(output == NULL) return;
     
-    _addResultTime("L2read", currentChip.cache_access_speed_l2);
+    if(output_ring != NULL)
+    {
+        _pushOutput(OUTPUT_CHAR, NULL, 0, (unsigned char)c);
+        return;
+    }
     
-    int length = _getTLBL2UsedBlocks(chipID);
-     
-    // swap it with the last one, preparing for LRU
-    _swapTLBByLRU(chipID, tlbIndex, length - 1);   
+    fputc(c, output);
 }
 
-void _readFromCacheL3(int chipID, int coreID, int tblIndex)
+void Simulator::_outputHex(unsigned long number)
 {
-    int blockID = tlb_l3[tblIndex].block_id;
-                   
-    // check if it is shared, if yes, call broadcast
-    if(array_usage_l3[blockID] != chipID * 10 + coreID)
+    if(output == NULL) return;
+    
+    if(output_ring != NULL)
     {
-      array_usage_l3[blockID] = chipID * 10 + coreID;                                    
-      tlb_l3[tblIndex].state = 'S';                                       
+        _pushOutput(OUTPUT_HEX, NULL, 0, number);
+        return;
     }
     
-    l3ID += _num2str(blockID);
-    l3ID += "&";
-    l3State += tlb_l3[tblIndex].state;
-    l3State += "&";
-       
-    _addResultTime("L3read", cache_access_speed_l3);
+    _writeHex(output, number);
+}
+
+void _writeHex(FILE *file, unsigned long number)
+{
+    char digits[24];
+    int position = sizeof(digits);
+    
+    // fill the digits from the end
+    digits[--position] = '\0';
     
-    int length = _getTLBL3UsedBlocks();
+    do
+    {
+        digits[--position] = "0123456789abcdef"[number % 16];
+        number /= 16;
+    } while(number != 0);
+    
+    digits[--position] = 'x';
+    digits[--position] = '0';
     
-    // swap it with the last one, preparing for LRU
-    _swapTLBL3ByLRU(tblIndex, length - 1); 
+    fputs(digits + position, file);
 }
 
-void _loadMemToCacheL2(int chipID, int coreID, int loadingPage)
+void Simulator::_outputCommand(const command *cmd)
 {
-    chip currentChip = array_chips[chipID];
+    if(quiet_output) return;
     
-    int availableBlock = _findAvailableBlockInCacheL2(chipID);
-                   
-    //cout << "availableBlock in L2 is " << availableBlock << endl;
+    _outputString(funcNames[cmd->type].c_str());
+    _outputChar('(');
     
-    // not -1, means there is empty block, use it
-    // or it is full, call take out
-    if(availableBlock != -1)
+    if(cmd->chip_id != -1)
     {
-       // mark it as used               
-       currentChip.array_usage_l2[availableBlock] = coreID;
-       
-       // add into TLB        
-       currentChip.tlb_l2[availableBlock].block_id = availableBlock;
-       currentChip.tlb_l2[availableBlock].memory_page = loadingPage;
-       currentChip.tlb_l2[availableBlock].state = 'E';
-       currentChip.tlb_l2[availableBlock].valid = 1;
-       
-       l2ID += _num2str(availableBlock);
-       l2ID += "&";
-       l2State += currentChip.tlb_l2[availableBlock].state;
-       l2State += "&";
-       
-       // add memory loading time
-       _addResultTime("mem_read", memory_access_speed);
-       
-       // add L2 read time
-       _addResultTime("L2read", currentChip.cache_access_speed_l2);
-       
+        _outputNumber(cmd->chip_id);
+        _outputChar(',');
     }
-    else
+    
+    switch(cmd->type)
     {
-       // take the first one out by LRU
-       entry oldEntry = _takeTheFirstOutByLRU(chipID);
-       int indexOfLastOne = currentChip.total_block_l2-1;
-       
-       // mark it as used
-       currentChip.array_usage_l2[oldEntry.block_id] = coreID;
-       
-       // add into TLB
-       currentChip.tlb_l2[indexOfLastOne].block_id = oldEntry.block_id;
-       currentChip.tlb_l2[indexOfLastOne].memory_page = loadingPage;
-       currentChip.tlb_l2[indexOfLastOne].state = 'E';
-       currentChip.tlb_l2[indexOfLastOne].valid = 1;
-       
-       l2ID += _num2str(oldEntry.block_id);
-       l2ID += "&";
-       l2State += currentChip.tlb_l2[indexOfLastOne].state;
-       l2State += "&";
-       
-       // add times
-       _addResultTime("replace", replacement_speed);
-       
-       if(oldEntry.state == 'M')
-       {
-           _addResultTime("L2writeback", memory_access_speed);
-       }
-       
-       _addResultTime("mem_read", memory_access_speed);
+        case CMD_MEMORY_SIZE:
+        case CMD_CACHE_LINE_SIZE:
+        case CMD_CACHE_SIZE:
+            _outputNumber(cmd->size.data);
+            _outputString(UnitSizeNames[cmd->size.unit]);
+            break;
+        
+        case CMD_NUM_OF_CHIPS:
+        case CMD_NUM_OF_CORES:
+        case CMD_CACHE_ASSOCIATIVITY:
+            _outputNumber(cmd->number);
+            break;
+        
+        case CMD_CACHE_ACCESS_SPEED:
+        case CMD_REPLACEMENT_SPEED:
+        case CMD_BROADCAST_SPEED:
+        case CMD_MEMORY_ACCESS_SPEED:
+            _outputNumber(cmd->time.data);
+            _outputString(UnitTimeNames[cmd->time.unit]);
+            break;
         
-       _addResultTime("L2read", currentChip.cache_access_speed_l2);
+        default:
+            _outputNumber(cmd->number);
+            _outputChar(',');
+            _outputHex(cmd->address);
+            _outputChar(',');
+            _outputNumber(cmd->size.data);
+            _outputString(UnitSizeNames[cmd->size.unit]);
+            break;
     }
+    
+    _outputString(")\n");
 }
 
-void _writeToCacheL3(int chipID, int coreID, int loadingPage, bool isRead)
+void Simulator::_outputNumber(unsigned long number)
 {
-    int availableBlock = _findAvailableBlockInCacheL3();
+    if(output == NULL) return;
     
-    // not -1, means there is empty block, use it
-    // or it is full, call take out               
-    if(availableBlock != -1)
+    if(output_ring != NULL)
     {
-       // mark it as used
-       array_usage_l3[availableBlock] = chipID * 10 + coreID;
-       
-       // add into TLB                           
-       tlb_l3[availableBlock].block_id = availableBlock;
-       tlb_l3[availableBlock].memory_page = loadingPage;
-       
-       // set state
-       if(isRead)
-       {
-           tlb_l3[availableBlock].state = 'E';
-       }
-       else
-       {
-           tlb_l3[availableBlock].state = 'M';
-       }
-       
-       tlb_l3[availableBlock].valid = 1;
-       
-       l3ID += _num2str(availableBlock);
-       l3ID += "&";
-       l3State += tlb_l3[availableBlock].state;
-       l3State += "&";
-       
-       // add write time
-       _addResultTime("L3write", cache_access_speed_l3);   
+        _pushOutput(OUTPUT_NUMBER, NULL, 0, number);
+        return;
     }
-    else
+    
+    _writeNumber(output, number);
+}
+
+void _writeNumber(FILE *file, unsigned long number)
+{
+    char digits[24];
+    int position = sizeof(digits);
+    
+    // fill the digits from the end
+    digits[--position] = '\0';
+    
+    do
     {
-      // take the first one out by LRU
-       entry oldEntry = _takeTheFirstOutL3ByLRU();
-       int indexOfLastOne = total_block_l3-1;
-       
-       // mark it as used
-       array_usage_l3[availableBlock] = chipID * 10 + coreID;
-       
-       // add into TLB
-       tlb_l3[indexOfLastOne].block_id = oldEntry.block_id;
-       tlb_l3[indexOfLastOne].memory_page = loadingPage;
-       
-       if(isRead)
-       {
-           tlb_l3[indexOfLastOne].state = 'E';
-       }
-       else
-       {
-           tlb_l3[indexOfLastOne].state = 'M';
-       }
-       
-       tlb_l3[indexOfLastOne].valid = 1;
-       
-       l3ID += _num2str(oldEntry.block_id);
-       l3ID += "&";
-       l3State += tlb_l3[indexOfLastOne].state;
-       l3State += "&";
-       
-       _addResultTime("replace", replacement_speed);
-       
-       if(oldEntry.state == 'M')
-       {
-           _addResultTime("L3writeback", memory_access_speed);
-       }
-       
-       if(oldEntry.state == 'M' || oldEntry.state == 'S')
-       {
-           array_usage_l3[oldEntry.block_id] = chipID * 10 + coreID;
-           _addResultTime("broadcast", broadcast_speed);
-       } 
-    }
+        digits[--position] = '0' + number % 10;
+        number /= 10;
+    } while(number != 0);
+    
+    fputs(digits + position, file);
+}
+
+#ifdef CACHE_KERNEL_HOOKS
+/*
+* hooks of the microbenchmarks, they only pass the call on, so each internal function is timed as it is
+*/
+unsigned long Simulator::kernelBlocksL2()
+{
+    return array_chips[0].total_block_l2;
+}
+
+unsigned long Simulator::kernelBlocksL3()
+{
+    return total_block_l3;
+}
+
+unsigned long Simulator::kernelMemoryPages()
+{
+    return memory_pages;
+}
+
+int Simulator::kernelSetsL2()
+{
+    return array_chips[0].number_of_sets_l2;
+}
+
+int Simulator::kernelWaysL2()
+{
+    return array_chips[0].number_of_ways_l2;
+}
+
+int Simulator::kernelCheckL2(unsigned long page)
+{
+    return _checkCacheL2(0, page, 0);
+}
+
+int Simulator::kernelCheckL3(unsigned long page)
+{
+    return _checkCacheL3(0, page, 0);
 }
 
-void _writeToCacheL2(int chipID, int coreID, int loadingPage)
+void Simulator::kernelSwapLRU(int tlbIndex)
 {
-    chip currentChip = array_chips[chipID];
+    _swapTLBByLRU(0, tlbIndex);
+}
+
+int Simulator::kernelTakeLRU(int setIndex)
+{
+    return _takeTheFirstOutByLRU(0, setIndex);
+}
+
+void Simulator::kernelPutBackLRU(int tlbIndex)
+{
+    chip *currentChip = &array_chips[0];
     
-    int availableBlock = _findAvailableBlockInCacheL2(chipID);
-           
-    //cout << "availableBlock is " << availableBlock << endl;
+    _swapTLBByLRU(0, tlbIndex);
+    _addPageToIndex(&currentChip->index_l2, _getLinePage(currentChip->tlb_l2[tlbIndex]), tlbIndex);
+}
+
+void Simulator::kernelEmptyBitmap(int taken)
+{
+    chip *currentChip = &array_chips[0];
     
-    // not -1, means there is empty block, use it
-    // or it is full, call take out 
-    if(availableBlock != -1)
+    // the bitmap of the cache is kept the first time, a new one of the last call is released after
+    if(kernel_bitmap == NULL)
     {
-       // mark it as used
-       currentChip.array_usage_l2[availableBlock] = coreID;
-       
-       // add into TLB
-       currentChip.tlb_l2[availableBlock].block_id = availableBlock;
-       currentChip.tlb_l2[availableBlock].memory_page = loadingPage;
-       currentChip.tlb_l2[availableBlock].state = 'M';
-       currentChip.tlb_l2[availableBlock].valid = 1;
-       
-       l2ID += _num2str(availableBlock);
-       l2ID += "&";
-       l2State += currentChip.tlb_l2[availableBlock].state;
-       l2State += "&";
-       
-       // add write time
-       _addResultTime("L2write", currentChip.cache_access_speed_l2);
+        kernel_bitmap = new block_bitmap(currentChip->bitmap_l2);
     }
     else
     {
-       // take the first one out by LRU
-       entry oldEntry = _takeTheFirstOutByLRU(chipID);
-       int indexOfLastOne = currentChip.total_block_l2-1;
-       
-       // add inot TLB
-       currentChip.tlb_l2[indexOfLastOne].block_id = oldEntry.block_id;
-       currentChip.tlb_l2[indexOfLastOne].memory_page = loadingPage;
-       currentChip.tlb_l2[indexOfLastOne].state = 'M';
-       currentChip.tlb_l2[indexOfLastOne].valid = 1;
-       
-       l2ID += _num2str(oldEntry.block_id);
-       l2ID += "&";
-       l2State += currentChip.tlb_l2[indexOfLastOne].state;
-       l2State += "&";
-       
-       // check if it is shared, if yes, call broadcast
-       if(oldEntry.state == 'S')
-       {      
-           _addResultTime("broadcast", broadcast_speed);
-       }
-       
-       // mark as used by me
-       currentChip.array_usage_l2[oldEntry.block_id] = coreID;
-       
-       _addResultTime("replace", replacement_speed);
-            
-       _addResultTime("L2write", currentChip.cache_access_speed_l2);
+        _freeBlockBitmap(&currentChip->bitmap_l2);
+    }
+    
+    _initBlockBitmap(&currentChip->bitmap_l2, currentChip->total_block_l2, currentChip->number_of_sets_l2);
+    
+    for(int s=0; s<currentChip->number_of_sets_l2; s++)
+    {
+        for(int w=0; w<taken; w++)
+        {
+            _findAvailableBlockInCacheL2(0, s);
+        }
     }
 }
 
-void _rewriteToCacheL2(int chipID, int coreID, int tlbIndex)
+int Simulator::kernelFindEmptyBlock(int setIndex)
 {
-    chip currentChip = array_chips[chipID];
-    int blockID = currentChip.tlb_l2[tlbIndex].block_id;
-           
-    // check if it is shared, if yes, call broadcast
-    if(currentChip.tlb_l2[tlbIndex].state == 'S')
-    {                                          
-      _addResultTime("broadcast", broadcast_speed);
-    }
-    
-    // mark as used by me
-    currentChip.array_usage_l2[blockID] = coreID;
-    currentChip.tlb_l2[tlbIndex].state = 'M';
-    
-    l2ID += _num2str(blockID);
-    l2ID += "&";
-    l2State += currentChip.tlb_l2[tlbIndex].state;
-    l2State += "&";
+    return _findAvailableBlockInCacheL2(0, setIndex);
+}
+
+int Simulator::kernelEmptyBlocks(int setIndex)
+{
+    return array_chips[0].bitmap_l2.free_count[setIndex];
+}
+
+void Simulator::kernelRestoreBitmap()
+{
+    chip *currentChip = &array_chips[0];
     
-    _addResultTime("L2write", currentChip.cache_access_speed_l2);
+    if(kernel_bitmap == NULL) return;
     
-    int length = _getTLBL2UsedBlocks(chipID);
-     
-    // swap it with the last one, preparing for LRU
-    _swapTLBByLRU(chipID, tlbIndex, length - 1);
+    _freeBlockBitmap(&currentChip->bitmap_l2);
+    currentChip->bitmap_l2 = *kernel_bitmap;
+    delete kernel_bitmap;
+    kernel_bitmap = NULL;
 }
 
-void _rewriteToCacheL3(int chipID, int coreID, int tlbIndex, int loadingPage)
+unsigned long Simulator::kernelNeedBlocks(unsigned long address, obj_size size)
 {
-    int blockID = tlb_l3[tlbIndex].block_id;
-           
-    // check if it is shared, if yes, call broadcast
-    if(tlb_l3[tlbIndex].state == 'M' || tlb_l3[tlbIndex].state == 'S')
+    return _caculateNeedBlocks(address, size);
+}
+
+const char *Simulator::kernelParse(int parser, const char *start, const char *end, obj_size *size)
+{
+    obj_time time;
+    int number;
+    unsigned long address;
+    command cmd;
+    
+    switch(parser)
     {
-      // mark other L2 as invalid
-      int otherChipID = array_usage_l3[blockID]/10;
-      int otherChipTLBIndex = _checkCacheL2(otherChipID, loadingPage, 0);
-      
-      array_chips[otherChipID].tlb_l2[otherChipTLBIndex].valid = 0;
-      array_chips[otherChipID].tlb_l2[otherChipTLBIndex].state = 'I';
-                              
-      // mark as used by me
-      array_usage_l3[blockID] = chipID * 10 + coreID;                                          
-      _addResultTime("broadcast", broadcast_speed);
+        case 0: return _getSize(start, end, size);
+        case 1: return _getTime(start, end, &time);
+        case 2: return _getNumber(start, end, &number);
+        case 3: return _getAddress(start, end, &address);
+        default: return _parseCommand(start, end, &cmd);
     }
+}
+#endif
+
+/*
+* C interface of the library, a simulator of the C interface is a Simulator,
+* and each call runs one command with the same checks as a line of a trace,
+* a command which can not run is not run, its error is kept instead of printed
+*/
+struct simulator
+{
+       Simulator engine;
+       const char *error = NULL; // the error message of the last call, NULL if it did not fail
+};
+
+static_assert(SIMULATOR_OPTS == NUMBER_OF_OPTS, "simulator_stats must count every operation");
+static_assert(sizeof(simulator_stats) == sizeof(core_stats), "simulator_stats must match core_stats");
+
+simulator *simulatorCreate(void)
+{
+    return new simulator;
+}
+
+void simulatorDestroy(simulator *sim)
+{
+    delete sim;
+}
+
+void simulatorSetOutput(simulator *sim, FILE *file, int quiet)
+{
+    sim->engine.output = file;
+    sim->engine.quiet_output = quiet;
+}
+
+int simulatorMemorySize(simulator *sim, unsigned long size, int unit)
+{
+    return _runSimulatorCommand(sim, CMD_MEMORY_SIZE, -1, 0, size, unit);
+}
+
+int simulatorNumOfChips(simulator *sim, int number)
+{
+    return _runSimulatorCommand(sim, CMD_NUM_OF_CHIPS, -1, number, 0, 0);
+}
+
+int simulatorNumOfCores(simulator *sim, int chipID, int number)
+{
+    return _runSimulatorCommand(sim, CMD_NUM_OF_CORES, chipID, number, 0, 0);
+}
+
+int simulatorCacheLineSize(simulator *sim, unsigned long size, int unit)
+{
+    return _runSimulatorCommand(sim, CMD_CACHE_LINE_SIZE, -1, 0, size, unit);
+}
+
+int simulatorCacheSize(simulator *sim, int chipID, unsigned long size, int unit)
+{
+    return _runSimulatorCommand(sim, CMD_CACHE_SIZE, chipID, 0, size, unit);
+}
+
+int simulatorCacheAssociativity(simulator *sim, int chipID, int number)
+{
+    return _runSimulatorCommand(sim, CMD_CACHE_ASSOCIATIVITY, chipID, number, 0, 0);
+}
+
+int simulatorCacheAccessSpeed(simulator *sim, int chipID, unsigned long time, int unit)
+{
+    return _runSimulatorCommand(sim, CMD_CACHE_ACCESS_SPEED, chipID, 0, time, unit);
+}
+
+int simulatorReplacementSpeed(simulator *sim, unsigned long time, int unit)
+{
+    return _runSimulatorCommand(sim, CMD_REPLACEMENT_SPEED, -1, 0, time, unit);
+}
+
+int simulatorBroadcastSpeed(simulator *sim, unsigned long time, int unit)
+{
+    return _runSimulatorCommand(sim, CMD_BROADCAST_SPEED, -1, 0, time, unit);
+}
+
+int simulatorMemoryAccessSpeed(simulator *sim, unsigned long time, int unit)
+{
+    return _runSimulatorCommand(sim, CMD_MEMORY_ACCESS_SPEED, -1, 0, time, unit);
+}
+
+int simulatorRead(simulator *sim, int chipID, int coreID, unsigned long address, unsigned long size)
+{
+    sim->error = sim->engine.tryAccess(chipID, coreID, address, size, 0);
     
-    tlb_l3[tlbIndex].state = 'M';
-    
-    l3ID += _num2str(blockID);
-    l3ID += "&";
-    l3State += tlb_l3[tlbIndex].state;
-    l3State += "&";
-       
-    _addResultTime("L3write", cache_access_speed_l3);
+    return sim->error == NULL ? 0 : -1;
+}
+
+int simulatorWrite(simulator *sim, int chipID, int coreID, unsigned long address, unsigned long size)
+{
+    sim->error = sim->engine.tryAccess(chipID, coreID, address, size, 1);
     
-    int length = _getTLBL3UsedBlocks();
-     
-    // swap it with the last one, preparing for LRU
-    _swapTLBL3ByLRU(tlbIndex, length - 1);
+    return sim->error == NULL ? 0 : -1;
 }
 
-void _checkCommandsOrder(int index)
+int simulatorGetStats(simulator *sim, int chipID, int coreID, simulator_stats *stats)
 {
-    if((commands[0] && commands[1] && commands[2]) || (commands[0] && commands[2]))
-    {
-       commands[index] = 1;
-    }
-    else
+    core_stats total;
+    
+    if(!sim->engine.getStats(chipID, coreID, &total))
     {
-       cout << "Not input memory size, it must be the first command!" << endl;
-       exit(1); 
+        sim->error = "simulatorGetStats::Invalid chip ID or core ID!";
+        return -1;
     }
+    
+    sim->error = NULL;
+    memcpy(stats, &total, sizeof(total));
+    return 0;
 }
 
-void _checkCommandsReady()
+const char *simulatorGetError(simulator *sim)
 {
-     for(int i=2; i<9; i++)
-     {
-         if(!commands[i])
-         {
-             cout << "Missing command:" << funcNames[i] << " for reading and writing, please input again!" << endl;
-             exit(1);
-         }
-     }
+    return sim->error;
 }
 
-void _checkValidIDs(int chipID, int coreID)
-{     
-     if(chipID >= number_of_chips || chipID < -1)
-     {
-         cout << "Invalid chip ID, please input again!" << endl;
-         exit(1);
-     }
-     
-     if(coreID >= array_chips[chipID].number_of_core || coreID < 0)
-     {
-         cout << "Invalid core ID, please input again!" << endl;
-         exit(1);
-     }
+void simulatorPrintStats(simulator *sim)
+{
+    sim->engine.printStats();
 }
 
-string _num2str(int number)
+int _runSimulatorCommand(simulator *sim, command_type type, int chipID, int number, unsigned long data, int unit)
 {
-    stringstream ss;
-    ss << number;
-    return ss.str();
+    command cmd;
+    
+    cmd.type = type;
+    cmd.chip_id = chipID;
+    cmd.number = number;
+    cmd.address = 0;
+    
+    // the unit is a unit of time for the speeds, and a unit of size for the others
+    bool isTime = type == CMD_CACHE_ACCESS_SPEED || type == CMD_REPLACEMENT_SPEED ||
+                  type == CMD_BROADCAST_SPEED || type == CMD_MEMORY_ACCESS_SPEED;
+    
+    if(unit < 0 || unit > (isTime ? (int)ns : (int)GB))
+    {
+        sim->error = isTime ? "_runSimulatorCommand::Not found expected unit(us, ns), invalid input!" :
+                              "_runSimulatorCommand::Not found expected unit(B, KB, MB or GB), invalid input!";
+        return -1;
+    }
+    
+    cmd.size.data = data;
+    cmd.size.unit = (unit_size)unit;
+    cmd.time.data = data;
+    cmd.time.unit = (unit_time)unit;
+    
+    return _trySimulatorCommand(sim, &cmd);
 }
 
+int _trySimulatorCommand(simulator *sim, const command *cmd)
+{
+    sim->error = sim->engine.tryCommand(cmd);
+    
+    return sim->error == NULL ? 0 : -1;
+}
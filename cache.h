@@ -2,7 +2,8 @@
 * File name: cache.h
 * File abstract: this is a programm to simulate cache coherent, 
 *                this file defines the references to standard libraries,
-*                global variables, structs, and public functions
+*                structs, and the Simulator class with its public functions,
+*                the structs of the caches and engines are in cache.cpp
 * 
 * Version: 1.0
 * Author: Xiaoming Sun
@@ -22,14 +23,17 @@
 #include <cstdlib>
 #include <iostream>
 #include <string>
-#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <stdint.h>
 
 using namespace std;
 
 enum unit_size{B,KB,MB,GB}; // enum type for unit of size
-const char *UnitSizeNames[] = {"B", "KB", "MB", "GB"}; // name array for unit of size
+const char *const UnitSizeNames[] = {"B", "KB", "MB", "GB"}; // name array for unit of size
 enum unit_time{us,ns}; // enum type for unit of time
-const char *UnitTimeNames[] = {"us", "ns"}; // name array for unit of time
+const char *const UnitTimeNames[] = {"us", "ns"}; // name array for unit of time
 
 /*
 * struct size
@@ -53,79 +57,398 @@ struct obj_time
        unit_time unit;
 };
 
-/* 
-* This function is to set memory size
-*	size is a struct size with number and unit
+/*
+* enum type for input commands, in the same order as funcNames
 */
-void memorySize(obj_size size);
+enum command_type{CMD_MEMORY_SIZE, CMD_NUM_OF_CHIPS,
+                  CMD_NUM_OF_CORES, CMD_CACHE_LINE_SIZE,
+                  CMD_CACHE_SIZE, CMD_CACHE_ACCESS_SPEED,
+                  CMD_REPLACEMENT_SPEED, CMD_BROADCAST_SPEED, CMD_MEMORY_ACCESS_SPEED,
+                  CMD_CACHE_ASSOCIATIVITY, CMD_READ, CMD_WRITE, NUMBER_OF_COMMANDS};
 
-/* 
-* This function is to set the number of chips, it is optional for 1 chip
-*	number is int to describe the number of chip
+/*
+* struct command, one input line after parsing
+*	type is the function to call
+* 	chip_id is the chip ID, -1 means no chip ID in the input
+*   number is the core ID for read and write, or the number for numOfChips, numOfCores and cacheAssociativity
+*   address is the memory address for read and write
+*   size is the size for memorySize, cacheLineSize, cacheSize, read and write
+*   time is the time for cacheAccessSpeed, replacementSpeed, broadcastSpeed and memoryAccessSpeed
 */
-void numOfChips(int number);
+struct command
+{
+       command_type type;
+       int chip_id;
+       int number;
+       unsigned long address;
+       obj_size size;
+       obj_time time;
+};
 
-/* 
-* This function is to set the number of cores for each chip
-*   chipID is the ID of chip to set, if no chipID, the same number of cores for all chips
-*	number is int to describe the number of chip
-*/
-void numOfCores(int chipID, int number);
+enum opt_type{OPT_L2HIT, OPT_L2MISS, OPT_L3HIT, OPT_L3MISS,
+              OPT_L2READ, OPT_L3READ, OPT_L2WRITE, OPT_L3WRITE,
+              OPT_L2WRITEBACK, OPT_L3WRITEBACK, OPT_MEMREAD,
+              OPT_REPLACE, OPT_BROADCAST, NUMBER_OF_OPTS}; // enum type for operation
 
-/* 
-* This function is to set cache line size
-*   size is a struct size with number and unit
+/*
+* struct opt_time
+* 	time is the elapse time of each operation
+*   count is the number of each operation
 */
-void cacheLineSize(obj_size size);
+struct opt_time
+{
+       obj_time time;
+       int count;
+};
 
-/* 
-* This function is to set cache size for each chip
-*   chipID is the ID of chip to be set, if no chipID, it is L2 for 1 chip, it is L3 for multiple chips
-*   size is a struct size with number and unit
+/*
+* struct core_stats, the counters of one core for the summary
+*	reads is the number of reads
+* 	writes is the number of writes
+*   counts is the number of each operation
+*   time is the total simulated time in ns
 */
-void cacheSize(int chipID, obj_size size);
+struct core_stats
+{
+       unsigned long reads;
+       unsigned long writes;
+       unsigned long counts[NUMBER_OF_OPTS];
+       unsigned long time;
+};
 
-/* 
-* This function is to set cache access speed for each chip
-*   chipID is the ID of chip to be set, if no chipID, it is L2 for 1 chip, it is L3 for multiple chips
-*   time is a struct time with number and unit
+/*
+* statistics export, one row for each read or write, then one row of counters for each core,
+* all formats have the same columns, kind is 0 for a read or write and 1 for the counters of a core
+*   csv is a header line and one line for each row
+*   jsonl is one object for each row
+*   columnar is a header with the column names, then blocks of up to EXPORT_BLOCK_ROWS rows
+*   with each column stored together as 64-bit numbers, a block of 0 rows is the end
 */
-void cacheAccessSpeed(int chipID, obj_time time);
+enum export_format{EXPORT_CSV, EXPORT_JSONL, EXPORT_COLUMNAR};
 
-/* 
-* This function is to set cache replacement speed
-*   time is a struct time with number and unit
-*/
-void replacementSpeed(obj_time time);
+#define EXPORT_MAGIC "CCST"
+#define EXPORT_VERSION 1
+#define EXPORT_BLOCK_ROWS 65536
+#define EXPORT_BUFFER_SIZE (1 << 20)
+#define EXPORT_COLUMNS (10 + NUMBER_OF_OPTS)
 
-/* 
-* This function is to set broadcast speed
-*   time is a struct time with number and unit
+/*
+* the caches, results and engines of a simulator are only pointed to here, they are defined in cache.cpp
 */
-void broadcastSpeed(obj_time time);
+enum trace_compression : int;
+enum output_kind : int;
+struct trace_stream;
+struct line_result;
+struct page_index;
+struct lru_list;
+struct block_bitmap;
+struct chip;
+struct sweep_trace;
+struct stack_distance;
+struct shard_batch;
+struct token_ring;
+struct batch_ring;
+struct coherence_line_ring;
+struct coherence_event_ring;
+struct chip_order_ring;
+struct worker_thread;
+struct line_counter;
 
-/* 
-* This function is to set meory access speed
-*   time is a struct time with number and unit
-*/
-void memoryAccessSpeed(obj_time time);
-
-/* 
-* This function is to read data from specified address
-*   chipID is the ID of chip which is sending the request
-*   coreID is the ID of core which is sending the request
-*   address is an address of memory
-*   size is a struct size with number and unit
-*/
-void read(int chipID, int coreID, string address, obj_size size);
-
-/* 
-* This function is to write data to specified address
-*   chipID is the ID of chip which is sending the request
-*   coreID is the ID of core which is sending the request
-*   address is an address of memory
-*   size is a struct size with number and unit
+/*
+* class Simulator, one cache hierarchy with its configuration, results and statistics,
+* every instance keeps its own state, so independent instances can run in one process at the same time
 */
-void write(int chipID, int coreID, string address, obj_size size);
+class Simulator
+{
+public:
+    FILE *output = stdout; // the file to print commands, results and the summary, NULL to print nothing
+    bool quiet_output = 0; // not print each command and its result, only the summary at the end
+    unsigned long stats_interval = 0; // print the summary every stats_interval reads and writes, 0 means never
+    sweep_trace *record_trace = NULL; // keep each command in this trace instead of running it, if not NULL
+    bool stack_analysis = 0; // find the LRU stack distance of each line of a read or write instead of simulating it
+    int shard_threads = 0; // simulate the lines of reads and writes on up to this many threads by sets of the caches, 0 means one thread
+    bool chip_threads = 0; // simulate L2 of each chip on its own thread, and L3 in the order of the trace on another thread
+
+    Simulator(); // construct an empty simulator, configured by the commands of a trace
+    ~Simulator(); // release the caches and statistics of this simulator
+
+    /*
+    * This function is to set memory size
+    *	size is a struct size with number and unit
+    */
+    void memorySize(obj_size size);
+
+    /*
+    * This function is to set the number of chips, it is optional for 1 chip
+    *	number is int to describe the number of chip
+    */
+    void numOfChips(int number);
+
+    /*
+    * This function is to set the number of cores for each chip
+    *   chipID is the ID of chip to set, if no chipID, the same number of cores for all chips
+    *	number is int to describe the number of chip
+    */
+    void numOfCores(int chipID, int number);
+
+    /*
+    * This function is to set cache line size
+    *   size is a struct size with number and unit
+    */
+    void cacheLineSize(obj_size size);
+
+    /*
+    * This function is to set cache size for each chip
+    *   chipID is the ID of chip to be set, if no chipID, it is L2 for 1 chip, it is L3 for multiple chips
+    *   size is a struct size with number and unit
+    */
+    void cacheSize(int chipID, obj_size size);
+
+    /*
+    * This function is to split caches into sets, it is optional for fully associative caches
+    *   chipID is the ID of chip to be set, if no chipID, it is L2 for 1 chip, it is L3 for multiple chips
+    *   number is int to describe the number of ways in each set, it must divide the total blocks
+    */
+    void cacheAssociativity(int chipID, int number);
+
+    /*
+    * This function is to set cache access speed for each chip
+    *   chipID is the ID of chip to be set, if no chipID, it is L2 for 1 chip, it is L3 for multiple chips
+    *   time is a struct time with number and unit
+    */
+    void cacheAccessSpeed(int chipID, obj_time time);
+
+    /*
+    * This function is to set cache replacement speed
+    *   time is a struct time with number and unit
+    */
+    void replacementSpeed(obj_time time);
+
+    /*
+    * This function is to set broadcast speed
+    *   time is a struct time with number and unit
+    */
+    void broadcastSpeed(obj_time time);
+
+    /*
+    * This function is to set meory access speed
+    *   time is a struct time with number and unit
+    */
+    void memoryAccessSpeed(obj_time time);
+
+    /*
+    * This function is to read data from specified address
+    *   chipID is the ID of chip which is sending the request
+    *   coreID is the ID of core which is sending the request
+    *   address is an address of memory
+    *   size is a struct size with number and unit
+    */
+    void read(int chipID, int coreID, string address, obj_size size);
+
+    /*
+    * This function is to write data to specified address
+    *   chipID is the ID of chip which is sending the request
+    *   coreID is the ID of core which is sending the request
+    *   address is an address of memory
+    *   size is a struct size with number and unit
+    */
+    void write(int chipID, int coreID, string address, obj_size size);
+
+    /*
+    * run commands or a whole trace, print the summary and export the statistics
+    */
+    void runCommand(const command *cmd); // check the order of a command and call its function, print the error and exit if it can not run
+    const char *tryCommand(const command *cmd); // run a command if it can run, return its error message without running it if not, it never exits
+    const char *tryAccess(int chipID, int coreID, unsigned long address, unsigned long bytes, bool isWrite); // tryCommand for a read or write of the lines which the bytes from address touch
+    void runTextTrace(); // read the text trace from standard input and run each command
+    void runBinaryTrace(FILE *file); // read a binary trace and run each command
+    void runTraceFile(const char *fileName, bool isPipeline); // map a text or binary trace file into memory and run each command
+    void printStats(); // print the counters of each core, each chip and the total
+    void openExport(const char *format, const char *fileName); // start to export statistics into a file
+    void closeExport(); // export the counters of each core and close the export file
+    void printMissRatioCurves(); // print the miss ratio of L2 of each chip and of L3 for each size, from the stack distances, L3 behind L2 of the trace
+    bool getStats(int chipID, int coreID, core_stats *stats); // add up the counters of a core, a chip(coreID -1) or all chips(chipID -1), false if an ID is invalid
+
+#ifdef CACHE_KERNEL_HOOKS
+    /*
+    * hooks of the microbenchmarks in microbench.cpp, only built with CACHE_KERNEL_HOOKS,
+    * each one calls an internal function on L2 of chip 0 or on L3, without adding its time
+    */
+    unsigned long kernelBlocksL2(); // the total blocks of L2
+    unsigned long kernelBlocksL3(); // the total blocks of L3
+    unsigned long kernelMemoryPages(); // the total pages of memory
+    int kernelSetsL2(); // the number of sets of L2
+    int kernelWaysL2(); // the number of ways of each set of L2
+    int kernelCheckL2(unsigned long page); // _checkCacheL2
+    int kernelCheckL3(unsigned long page); // _checkCacheL3
+    void kernelSwapLRU(int tlbIndex); // _swapTLBByLRU
+    int kernelTakeLRU(int setIndex); // _takeTheFirstOutByLRU
+    void kernelPutBackLRU(int tlbIndex); // make a block taken by kernelTakeLRU the most recently used and index its page again
+    void kernelEmptyBitmap(int taken); // start a new bitmap of L2 with taken blocks of each set used, the one of the cache is kept aside
+    int kernelFindEmptyBlock(int setIndex); // _findAvailableBlockInCacheL2
+    int kernelEmptyBlocks(int setIndex); // the empty blocks left in a set of the new bitmap
+    void kernelRestoreBitmap(); // release the new bitmap and put back the one of the cache
+    unsigned long kernelNeedBlocks(unsigned long address, obj_size size); // _caculateNeedBlocks
+    static const char *kernelParse(int parser, const char *start, const char *end, obj_size *size); // _getSize(into size), _getTime, _getNumber, _getAddress or _parseCommand for parser 0 to 4
+#endif
+
+private:
+    /*
+    * memory_size is the size of memory
+    * cache_line_size is the size of cache line
+    * cache_size_l3 is the size of l3
+    */
+    obj_size memory_size = {}, cache_line_size = {}, cache_size_l3 = {};
+
+    /*
+    * replacement_speed is the speed of cache replacement
+    * broadcast_speed is the speed of broadcast
+    * memory_access_speed is the access speed of memory
+    * cache_access_speed_l3 is the access speed of cache L3
+    */
+    obj_time replacement_speed = {}, broadcast_speed = {}, memory_access_speed = {}, cache_access_speed_l3 = {};
+
+    /*
+    * memory_pages is the total pages of memory, divided by cache line size
+    * total_block_l3 is the total blocks in cache L3, divided by cache line size
+    * number_of_ways_l3 is the number of blocks in each set of cache L3
+    * number_of_sets_l3 is the number of sets in cache L3, 1 means fully associative
+    */
+    unsigned long memory_pages = 0, total_block_l3 = 0;
+    int number_of_ways_l3 = 0, number_of_sets_l3 = 1;
+
+    int number_of_chips = 1; // the number of chips, default is 1
+    bool commands[NUMBER_OF_COMMANDS] = {}; // an array to record commands for ordering and usage
+    char error_text[128] = {}; // the last error message which has a number in it
+#ifdef CACHE_KERNEL_HOOKS
+    block_bitmap *kernel_bitmap = NULL; // the bitmap of L2 of chip 0 kept aside by kernelEmptyBitmap
+#endif
+
+    token_ring *output_ring = NULL; // the output goes to the formatting stage if not NULL
+
+    /*
+    * result_l2 is to record all lines used in cache L2
+    * result_l3 is to record all lines used in cache L3
+    */
+    line_result *result_l2 = NULL, *result_l3 = NULL;
+
+    unsigned long long *tlb_l3 = NULL; // TLB for cache L3
+    page_index *index_l3 = NULL; // page to TLB index lookup for cache L3
+    lru_list *lru_l3 = NULL; // access order of cache L3
+    block_bitmap *bitmap_l3 = NULL; // empty blocks of cache L3
+    chip *array_chips = NULL; // an array to record all chips
+
+    opt_time result_time[NUMBER_OF_OPTS] = {}; // an array to record time results of each operation
+    opt_type result_order[NUMBER_OF_OPTS] = {}; // an array to record operations in the order they first happen
+    int result_index = 0; // an index to tell how many time results it has
+
+    core_stats **chip_stats = NULL; // counters of each core of each chip, built at the first read or write
+    int *stats_cores = NULL; // the number of cores with counters of each chip
+    unsigned long stats_accesses = 0; // the number of reads and writes so far
+
+    FILE *export_file = NULL; // the file to export statistics, NULL if not export
+    export_format export_type = EXPORT_CSV; // the format of the export file
+    char *export_buffer = NULL; // the buffer of the export file
+    unsigned long *export_columns = NULL; // the rows of the current block, column by column, for columnar export
+    int export_rows = 0; // the number of rows in the current block
+
+    stack_distance *stack_l2 = NULL; // stack distances of the lines of each chip, built at the first read or write
+    stack_distance *stack_l3 = NULL; // stack distances of the writes of all chips and of their lines which miss in L2
+
+    Simulator *shards = NULL; // a simulator for the sets of each shard, started at the first read or write
+    int number_of_shards = 0; // the number of shards, it divides the number of sets of every cache
+    worker_thread *shard_workers = NULL; // the thread of each shard
+    batch_ring *shard_rings = NULL; // the batches of lines for each shard
+    shard_batch *shard_pending = NULL; // the batch being filled for each shard
+
+    Simulator *stages = NULL; // a simulator for L2 of each chip, then one for L3, started at the first read or write
+    worker_thread *stage_workers = NULL; // the thread of each stage
+    coherence_line_ring *stage_lines = NULL; // the lines of each chip
+    coherence_event_ring *stage_events = NULL; // the event of each line of each chip for the L3 stage
+    coherence_event_ring *stage_effects = NULL; // the fills and invalidations of the L3 stage for each chip
+    chip_order_ring *stage_order = NULL; // the chip of each line in the order of the trace
+    line_counter *resolved_lines = NULL; // the number of lines resolved by the L3 stage
+    unsigned long next_line = 0; // the sequence number of the next line
+    unsigned long **write_at = NULL; // 1 + the sequence number of the last write to each set of L2 of each chip, 0 for none
+    coherence_event_ring *effect_rings = NULL; // in the L3 stage, where the invalidations for each chip go
+
+    /*
+    * declare internal functions which use the state of this simulator
+    */
+    const char *_callCommand(const command *cmd); // call the function of a command which can run, return the error message of a read or write or NULL
+    const char *_readAddress(int chipID, int coreID, unsigned long address, obj_size size); // read with a parsed address, return the error message or NULL
+    const char *_writeAddress(int chipID, int coreID, unsigned long address, obj_size size); // write with a parsed address, return the error message or NULL
+    void _runTextLine(const char *line, const char *end); // echo and run one line of a text trace
+    void _runPipeline(const char *data, size_t length, bool isBinary); // run a mapped trace with the parsing, simulation and formatting stages on their own threads
+    void _formatStage(token_ring *tokens); // write the output tokens to the output file
+    void _pushOutput(output_kind kind, const char *str, size_t length, unsigned long value); // pass one piece of output to the formatting stage
+    void _drainOutput(); // wait for the formatting stage to write all output so far
+    void _runCompressedTrace(const char *data, size_t length, trace_compression compression); // decompress a trace on another thread and run each command
+    void _feedTraceStream(trace_stream *stream, const char *data, size_t length); // run the commands in one chunk of a trace
+    void _finishTraceStream(trace_stream *stream); // run what is left at the end of a trace
+    void _outputCommand(const command *cmd); // append a command in text form to the output
+    unsigned long _caculateTotalBlocks(obj_size size); // caculate total blocks
+    unsigned long _caculateNeedBlocks(unsigned long address, obj_size size); // culate need blocks in cache
+    int _checkCacheL2(int chipID, unsigned long loadingPage, bool isAddTime); // check whether it is existing in cache L2
+    int _checkCacheL3(int chipID, unsigned long loadingPage, bool isAddTime); // check whether it is existing in cache L3
+    int _hitMemoL2(int chipID, int coreID, unsigned long loadingPage, bool isWrite); // read or write the last line this core owns in M or E without the full path, -1 if it is not that line
+    int _checkMemoL2(int chipID, int coreID, unsigned long loadingPage); // check whether it is the last line this core owns in M or E
+    void _rememberLineL2(int chipID, int coreID, int tlbIndex); // remember the last line this core touched in L2
+    void _forgetLineL2(int chipID, int tlbIndex); // forget a line in L2 for all cores
+    void _addResultTime(opt_type opt, obj_time time); // add operation and time into result
+    int _findAvailableBlockInCacheL2(int chipID, int setIndex); // find empty block in a set of cache L2 and take it
+    int _findAvailableBlockInCacheL3(int setIndex); // find empty block in a set of cache L3 and take it
+    int _takeTheFirstOutByLRU(int chipID, int setIndex); // take one out according to LRU from a set of cache L2
+    int _takeTheFirstOutL3ByLRU(int setIndex); // take one out according to LRU from a set of cache L3
+    void _swapTLBByLRU(int chipID, int tlbIndex); // move the latest access to the end of L2 LRU order
+    void _swapTLBL3ByLRU(int tlbIndex); // move the latest access to the end of L3 LRU order
+    void _readFromCacheL2(int chipID, int coreID, int tblIndex); // read data from cache L2
+    void _readFromCacheL3(int chipID, int coreID, int tblIndex); // read data from cache L3
+    void _loadMemToCacheL2(int chipID, int coreID, unsigned long loadingPage); // load data from memory to L2
+    void _writeToCacheL2(int chipID, int coreID, unsigned long loadingPage); // write data into cache L2
+    void _writeToCacheL3(int chipID, int coreID, unsigned long loadingPage, bool isRead); // write data into cache L3
+    void _rewriteToCacheL2(int chipID, int coreID, int tlbIndex); // rewrite data into cache L2
+    void _rewriteToCacheL3(int chipID, int coreID, int tlbIndex, unsigned long loadingPage); // rewrite data into cache L3
+    void _printResult(); // print out result
+    void _clearResult(); // clear the result of a read or write for the next one
+    void _collectStats(int chipID, int coreID, bool isWrite); // add the result of a read or write into the counters of its core
+    void _printStatsLine(const core_stats *stats); // print one line of counters
+    void _echoLine(const char *line, const char *end); // append an input line to the output
+    void _exportAccess(int chipID, int coreID, bool isWrite, unsigned long address, unsigned long loadingPage, int pageSize); // export the result of a read or write
+    void _exportRow(const unsigned long row[]); // write one row in the export format
+    void _exportBlock(); // write the rows of the current block for columnar export
+    const char *_checkCommand(const command *cmd); // check a command can run now, return the error message or NULL
+    const char *_checkCommandsReady(); // check commands are enough, return the error message or NULL
+    const char *_checkValidIDs(int chipID, int coreID); // check chipID and coreID is valid, return the error message or NULL
+    void _freeChips(); // release the caches of all chips
+    const char *_analyzeAccess(int chipID, int coreID, unsigned long address, obj_size size, bool isWrite); // add the lines of a read or write to the stack distances
+    void _printMissRatioCurve(int chipID, const stack_distance *stack); // print the miss ratio at each power of 2 blocks, chipID -1 for L3
+    void _copyConfig(Simulator *copy, int divisor, int firstChip, int lastChip, bool isL3); // configure another simulator with 1/divisor of the sets, L2 of chips firstChip to lastChip-1, and L3 if isL3
+    bool _startShards(); // split the caches into shards and start their threads, false if they can not be split
+    const char *_shardAccess(int chipID, int coreID, unsigned long address, obj_size size, bool isWrite); // pass the lines of a read or write to their shards
+    void _shardStage(batch_ring *batches); // simulate the lines of one shard
+    void _drainShards(); // wait for the shards to simulate the lines so far, and add their counters into this simulator
+    void _stopShards(); // stop the threads of the shards and release them
+    bool _startStages(); // start the stage of L2 of each chip and the L3 stage, false if there is no L3
+    const char *_stageAccess(int chipID, int coreID, unsigned long address, obj_size size, bool isWrite); // pass the lines of a read or write to the stage of its chip
+    void _chipStage(int chipID, coherence_line_ring *lines, coherence_event_ring *events, 
+                    coherence_event_ring *effects, line_counter *resolved); // simulate L2 of one chip
+    void _applyEffects(int chipID, coherence_event_ring *effects); // run the fills and invalidations from the L3 stage so far
+    void _l3Stage(chip_order_ring *order, coherence_event_ring *events, line_counter *resolved); // resolve the events of all chips in L3 in order
+    void _invalidateLineL2(int chipID, unsigned long loadingPage); // invalidate a page in L2 of a chip, or pass it to that chip from the L3 stage
+    void _drainStages(); // wait for the stages to simulate the lines so far, and add their counters into this simulator
+    void _moveStats(Simulator *from); // add the operations and time counted by another simulator into this one, and clear them there
+    void _stopStages(); // stop the threads of the stages and release them
+    void _outputString(const char *str); // append a string to the output
+    void _outputText(const char *str, size_t length); // append a string of given length to the output
+    void _outputChar(char c); // append a character to the output
+    void _outputNumber(unsigned long number); // append a decimal number to the output
+    void _outputHex(unsigned long number); // append a hexadecimal number with "0x" to the output
+
+    Simulator(const Simulator &); // a simulator owns its caches, it is not copied
+    Simulator &operator=(const Simulator &);
+
+    friend class drain_buffer; // cout waits for the output of the pipeline
+};
 
 #endif
@@ -0,0 +1,112 @@
+/*
+* File name: cache_api.h
+* File abstract: this is a programm to simulate cache coherent,
+*                this file defines the C interface of the simulator library,
+*                which runs commands with numbers instead of text and returns statistics in structs,
+*                build it with "make lib" and link libcache.a or libcache.so with -lstdc++ -pthread
+*
+* Version: 1.0
+* Author: Xiaoming Sun
+* Date: 2014-04-27
+*/
+
+/*
+* define cache api heads and avoid duplicated defination
+*/
+#ifndef Cache_API_H
+#define Cache_API_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum simulator_unit_size{SIM_B, SIM_KB, SIM_MB, SIM_GB}; // unit of size, the same order as unit_size
+enum simulator_unit_time{SIM_US, SIM_NS}; // unit of time, the same order as unit_time
+
+#define SIMULATOR_OPTS 13 // the number of operations counted in simulator_stats
+
+/*
+* struct simulator_stats, the counters of one core, one chip or all chips
+*	reads is the number of reads
+* 	writes is the number of writes
+*   counts is the number of each operation, in the order
+*   L2hit, L2miss, L3hit, L3miss, L2read, L3read, L2write, L3write,
+*   L2writeback, L3writeback, mem_read, replace, broadcast
+*   time is the total simulated time in ns
+*/
+typedef struct simulator_stats
+{
+       unsigned long reads;
+       unsigned long writes;
+       unsigned long counts[SIMULATOR_OPTS];
+       unsigned long time;
+} simulator_stats;
+
+typedef struct simulator simulator; // one simulator, each has its own caches and statistics
+
+/*
+* create and destroy a simulator, a new simulator prints each command and its result to standard output
+*/
+simulator *simulatorCreate(void);
+void simulatorDestroy(simulator *sim);
+
+/*
+* This function is to set where the simulator prints
+*   file is the file to print results and the summary into, NULL to print nothing
+*   quiet is 1 to print nothing for each read and write, it is the fastest way to run
+*/
+void simulatorSetOutput(simulator *sim, FILE *file, int quiet);
+
+/*
+* configure the simulator, in the same order and with the same rules as the commands of a trace,
+* a chipID of -1 means no chip ID, a unit is one of simulator_unit_size or simulator_unit_time,
+* return 0, or -1 if the command breaks a rule, then it is not run and simulatorGetError tells why
+*/
+int simulatorMemorySize(simulator *sim, unsigned long size, int unit);
+int simulatorNumOfChips(simulator *sim, int number);
+int simulatorNumOfCores(simulator *sim, int chipID, int number);
+int simulatorCacheLineSize(simulator *sim, unsigned long size, int unit);
+int simulatorCacheSize(simulator *sim, int chipID, unsigned long size, int unit);
+int simulatorCacheAssociativity(simulator *sim, int chipID, int number);
+int simulatorCacheAccessSpeed(simulator *sim, int chipID, unsigned long time, int unit);
+int simulatorReplacementSpeed(simulator *sim, unsigned long time, int unit);
+int simulatorBroadcastSpeed(simulator *sim, unsigned long time, int unit);
+int simulatorMemoryAccessSpeed(simulator *sim, unsigned long time, int unit);
+
+/*
+* This function is to read or write size bytes from specified address
+*   chipID is the ID of chip which is sending the request, -1 for one chip
+*   coreID is the ID of core which is sending the request
+*   return 0, or -1 if a configuration command is missing or an ID is invalid,
+*   then it is not run and simulatorGetError tells why, an address out of memory is ignored and returns 0
+*/
+int simulatorRead(simulator *sim, int chipID, int coreID, unsigned long address, unsigned long size);
+int simulatorWrite(simulator *sim, int chipID, int coreID, unsigned long address, unsigned long size);
+
+/*
+* This function is to get the counters of the reads and writes so far
+*   chipID is the ID of chip, -1 for the total of all chips
+*   coreID is the ID of core in that chip, -1 for the total of the chip
+*   stats is filled with the counters, all 0 before the first read or write
+*   return 0, or -1 if chipID or coreID is invalid
+*/
+int simulatorGetStats(simulator *sim, int chipID, int coreID, simulator_stats *stats);
+
+/*
+* This function is to get the error message of the last call which returned -1, NULL if the last call did not fail,
+* no call of the library prints an error or exits the program
+*/
+const char *simulatorGetError(simulator *sim);
+
+/*
+* This function is to print the summary of each core, each chip and the total to the output
+*/
+void simulatorPrintStats(simulator *sim);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
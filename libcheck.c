@@ -0,0 +1,164 @@
+/*
+* File name: libcheck.c
+* File abstract: this is a programm to simulate cache coherent,
+*                this file checks the C interface of the simulator library from C,
+*                each call which breaks a rule must return -1 with an error and leave the program running,
+*                and each read and write must count the lines of its bytes,
+*                build and run it with "make libcheck"
+*
+* Version: 1.0
+* Author: Xiaoming Sun
+* Date: 2014-04-27
+*/
+
+#include "cache_api.h" // reference to the C interface of the library
+
+#include <stdlib.h>
+#include <string.h>
+
+int checks = 0; // the number of checks which passed
+
+void _expect(int condition, const char *what); // count a check, print it and exit if it failed
+void _expectError(simulator *sim, int result, const char *error, const char *what); // check that a call failed with an error containing error
+void _expectLines(simulator *sim, int isWrite, unsigned long address, unsigned long size, unsigned long lines); // check the L2 lines of one read or write
+simulator *_createSimulator(unsigned long lineSize, int unit); // a simulator of 2 chips of 2 cores, which prints nothing
+
+int main(void)
+{
+    simulator *sim = simulatorCreate();
+    simulator_stats stats;
+    
+    simulatorSetOutput(sim, NULL, 1);
+    
+    // the order of the commands
+    _expectError(sim, simulatorNumOfChips(sim, 2), "memory size", "numOfChips before memorySize");
+    _expectError(sim, simulatorRead(sim, -1, 0, 0, 8), "Missing command", "read before the configuration");
+    _expect(simulatorMemorySize(sim, 1, SIM_GB) == 0 && simulatorGetError(sim) == NULL, "memorySize clears the error");
+    
+    // the owner of a line is chip ID * 10 + core ID in 16 bits
+    _expectError(sim, simulatorNumOfChips(sim, 6555), "Invalid number of chips", "one chip more than the owner bits hold");
+    _expect(simulatorNumOfChips(sim, 6554) == 0, "the most chips the owner bits hold");
+    _expectError(sim, simulatorNumOfCores(sim, -1, 7), "Too many cores", "one core more than the owner bits hold");
+    _expect(simulatorNumOfCores(sim, -1, 6) == 0, "the most cores the owner bits hold");
+    simulatorDestroy(sim);
+    
+    // the page of a line is in 44 bits
+    sim = simulatorCreate();
+    simulatorSetOutput(sim, NULL, 1);
+    simulatorMemorySize(sim, 16384, SIM_GB);
+    simulatorNumOfCores(sim, -1, 1);
+    _expectError(sim, simulatorCacheLineSize(sim, 1, SIM_B), "too many pages", "one page more than the page bits hold");
+    _expectError(sim, simulatorCacheLineSize(sim, 0, SIM_B), "Size is 0", "cache line size of 0");
+    _expectError(sim, simulatorCacheLineSize(sim, 1, SIM_GB + 1), "unit", "unknown unit");
+    simulatorDestroy(sim);
+    
+    // the IDs of a read or write
+    sim = _createSimulator(64, SIM_B);
+    _expectError(sim, simulatorRead(sim, 2, 0, 0, 8), "Invalid chip ID", "read of a chip which does not exist");
+    _expectError(sim, simulatorWrite(sim, 0, 2, 0, 8), "Invalid core ID", "write of a core which does not exist");
+    _expectError(sim, simulatorGetStats(sim, 0, 2, &stats), "Invalid", "stats of a core which does not exist");
+    _expect(simulatorRead(sim, 0, 0, 1UL << 40, 8) == 0, "an address out of memory is ignored");
+    
+    // the lines of [address, address + size) with 64B lines
+    _expectLines(sim, 0, 32, 32, 1);
+    _expectLines(sim, 0, 32, 33, 2);
+    _expectLines(sim, 1, 4096, 0, 0);
+    _expectLines(sim, 1, 4096 - 1, 2, 2);
+    _expectLines(sim, 0, 8192, 8192, 128);
+    simulatorDestroy(sim);
+    
+    // the lines of [address, address + size) with 1KB lines, the address is in KB like a trace
+    sim = _createSimulator(1, SIM_KB);
+    _expectLines(sim, 0, 0, 8192, 8);
+    _expectLines(sim, 1, 0, 2000, 2);
+    _expectLines(sim, 0, 3, 1025, 2);
+    simulatorDestroy(sim);
+    
+    // a chip without L2
+    sim = simulatorCreate();
+    simulatorSetOutput(sim, NULL, 1);
+    simulatorMemorySize(sim, 1, SIM_GB);
+    simulatorNumOfChips(sim, 2);
+    simulatorNumOfCores(sim, -1, 2);
+    simulatorCacheLineSize(sim, 64, SIM_B);
+    simulatorCacheSize(sim, 1, 4, SIM_KB);
+    simulatorCacheSize(sim, -1, 16, SIM_KB);
+    simulatorCacheAccessSpeed(sim, 1, 4, SIM_NS);
+    simulatorCacheAccessSpeed(sim, -1, 10, SIM_NS);
+    simulatorReplacementSpeed(sim, 2, SIM_NS);
+    simulatorBroadcastSpeed(sim, 4, SIM_NS);
+    simulatorMemoryAccessSpeed(sim, 100, SIM_NS);
+    _expectError(sim, simulatorRead(sim, 0, 0, 0, 8), "cache size of L2 of chip 0", "read of a chip without L2");
+    _expect(simulatorWrite(sim, 1, 0, 0, 8) == 0 && simulatorGetError(sim) == NULL, "write of a chip with L2 next to one without");
+    simulatorDestroy(sim);
+    
+    printf("libcheck: %d checks passed\n", checks);
+    
+    return EXIT_SUCCESS;
+}
+
+void _expect(int condition, const char *what)
+{
+    if(!condition)
+    {
+        printf("libcheck: FAILED %s\n", what);
+        exit(EXIT_FAILURE);
+    }
+    
+    checks++;
+}
+
+void _expectError(simulator *sim, int result, const char *error, const char *what)
+{
+    const char *message = simulatorGetError(sim);
+    
+    if(result != -1 || message == NULL || strstr(message, error) == NULL)
+    {
+        printf("libcheck: FAILED %s, returned %d with error \"%s\"\n", what, result, message == NULL ? "" : message);
+        exit(EXIT_FAILURE);
+    }
+    
+    checks++;
+}
+
+void _expectLines(simulator *sim, int isWrite, unsigned long address, unsigned long size, unsigned long lines)
+{
+    simulator_stats before, after;
+    int result;
+    
+    simulatorGetStats(sim, -1, -1, &before);
+    result = isWrite ? simulatorWrite(sim, 0, 1, address, size) : simulatorRead(sim, 0, 1, address, size);
+    simulatorGetStats(sim, -1, -1, &after);
+    
+    // each line is one L2 hit or miss
+    if(result != 0 || after.counts[0] + after.counts[1] - before.counts[0] - before.counts[1] != lines)
+    {
+        printf("libcheck: FAILED %s of %lu bytes at %lu, returned %d with %lu lines instead of %lu\n", isWrite ? "write" : "read",
+               size, address, result, after.counts[0] + after.counts[1] - before.counts[0] - before.counts[1], lines);
+        exit(EXIT_FAILURE);
+    }
+    
+    checks++;
+}
+
+simulator *_createSimulator(unsigned long lineSize, int unit)
+{
+    simulator *sim = simulatorCreate();
+    
+    simulatorSetOutput(sim, NULL, 1);
+    simulatorMemorySize(sim, 1, SIM_GB);
+    simulatorNumOfChips(sim, 2);
+    simulatorNumOfCores(sim, -1, 2);
+    simulatorCacheLineSize(sim, lineSize, unit);
+    simulatorCacheSize(sim, 0, 64, SIM_KB);
+    simulatorCacheSize(sim, 1, 64, SIM_KB);
+    simulatorCacheSize(sim, -1, 1, SIM_MB);
+    simulatorCacheAccessSpeed(sim, 0, 4, SIM_NS);
+    simulatorCacheAccessSpeed(sim, 1, 4, SIM_NS);
+    simulatorCacheAccessSpeed(sim, -1, 10, SIM_NS);
+    simulatorReplacementSpeed(sim, 2, SIM_NS);
+    simulatorBroadcastSpeed(sim, 4, SIM_NS);
+    simulatorMemoryAccessSpeed(sim, 100, SIM_NS);
+    
+    return sim;
+}
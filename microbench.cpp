@@ -0,0 +1,517 @@
+/*
+* File name: microbench.cpp
+* File abstract: this is a programm to simulate cache coherent,
+*                this file times the internal functions of the simulator one by one,
+*                the lookups, the LRU order, the empty block bitmap and the parsers,
+*                for each cache size and hit ratio it prints min, median, mean and standard deviation
+*                of cycles per call (TSC cycles on x86, ns elsewhere) over repeated batches
+*
+* Version: 1.0
+* Author: Xiaoming Sun
+* Date: 2014-04-27
+*/
+
+#include "cache.h" // reference to the simulator, built with CACHE_KERNEL_HOOKS to call its internal functions
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // read the time stamp counter
+#define TICK_UNIT "cycles"
+#else
+#define TICK_UNIT "ns"
+#endif
+
+#define MICRO_MAX_SIZES 16 // the most cache sizes of one run
+#define MICRO_MAX_RATIOS 16 // the most hit ratios of one run
+#define MICRO_NO_RATIO -1 // the kernel has no hit ratio
+
+/*
+* struct micro_config, what to run
+*	sizes is the L2 size of each run, L3 is twice as big
+* 	ratios is the hit ratio of each run, for the kernels which hit or miss
+*   calls is the number of calls in each batch
+*   repeats is the number of batches of each run
+*   ways is the number of ways of each cache, 0 means fully associative
+*/
+struct micro_config
+{
+       obj_size sizes[MICRO_MAX_SIZES];
+       int size_count;
+       double ratios[MICRO_MAX_RATIOS];
+       int ratio_count;
+       unsigned long calls;
+       int repeats;
+       int ways;
+};
+
+/*
+* struct micro_samples, ticks per call of each batch of one run
+*	ticks is the ticks per call of each batch
+* 	count is the number of batches so far
+*/
+struct micro_samples
+{
+       double *ticks;
+       int count;
+};
+
+volatile unsigned long MicroSink = 0; // keep the results of the timed calls
+
+/*
+* declare internal functions of the benchmarks, the kernels are called through the hooks of Simulator
+*/
+Simulator *_createSimulator(const micro_config *config, obj_size size); // configure 2 chips and fill L2 of chip 0
+void _benchLookups(Simulator *sim, const micro_config *config, const char *sizeText); // _checkCacheL2 and _checkCacheL3 with each hit ratio
+void _benchLRU(Simulator *sim, const micro_config *config, const char *sizeText); // _swapTLBByLRU and _takeTheFirstOutByLRU
+void _benchBitmap(Simulator *sim, const micro_config *config, const char *sizeText); // _findAvailableBlockInCacheL2 with each hit ratio
+void _benchParsers(Simulator *sim, const micro_config *config); // _caculateNeedBlocks, the _get* parsers and _parseCommand
+unsigned long _readTicks(); // the time stamp counter, or ns if there is none
+unsigned long _nextRandom(unsigned long *state); // get the next number of a xorshift random sequence
+void _addSample(micro_samples *samples, unsigned long start, unsigned long end, unsigned long calls); // add the ticks per call of one batch
+void _printSamples(const char *kernel, const char *sizeText, double ratio, unsigned long calls, micro_samples *samples); // print the statistics of a run
+bool _parseMicroSize(const char *text, obj_size *size); // parse a size like 32KB
+
+/*
+* main function, parse the options, then time each kernel with each cache size
+*/
+int main(int argc, char *argv[])
+{
+    micro_config config = {};
+    char defaultSizes[] = "32KB,1MB,32MB";
+    char defaultRatios[] = "0,0.5,0.9,1";
+    char *sizeList = defaultSizes;
+    char *ratioList = defaultRatios;
+
+    config.calls = 65536;
+    config.repeats = 15;
+    config.ways = 8;
+
+    // -s size,... L2 size of chip 0, L3 is twice as big, -h ratio,... hit ratios,
+    // -n N calls of each batch, -r N batches of each run, -a N ways, 0 for fully associative
+    for(int i=1; i<argc; i++)
+    {
+        bool hasValue = i+1 < argc;
+
+        if(strcmp(argv[i], "-s") == 0 && hasValue)
+        {
+            sizeList = argv[++i];
+        }
+        else if(strcmp(argv[i], "-h") == 0 && hasValue)
+        {
+            ratioList = argv[++i];
+        }
+        else if(strcmp(argv[i], "-n") == 0 && hasValue)
+        {
+            config.calls = strtoul(argv[++i], NULL, 10);
+        }
+        else if(strcmp(argv[i], "-r") == 0 && hasValue)
+        {
+            config.repeats = atoi(argv[++i]);
+        }
+        else if(strcmp(argv[i], "-a") == 0 && hasValue)
+        {
+            config.ways = atoi(argv[++i]);
+        }
+        else
+        {
+            cout << "Usage: " << argv[0] << " [-s L2size,...] [-h ratio,...] [-n calls] [-r repeats] [-a ways]" << endl;
+            exit(1);
+        }
+    }
+
+    char *sizeTexts[MICRO_MAX_SIZES];
+
+    for(char *text = strtok(sizeList, ","); text != NULL; text = strtok(NULL, ","))
+    {
+        if(config.size_count == MICRO_MAX_SIZES || !_parseMicroSize(text, &config.sizes[config.size_count]))
+        {
+            cout << "main::Not found expected cache size " << text << ", invalid input!" << endl;
+            exit(1);
+        }
+
+        sizeTexts[config.size_count++] = text;
+    }
+
+    for(char *text = strtok(ratioList, ","); text != NULL; text = strtok(NULL, ","))
+    {
+        char *end;
+        double ratio = strtod(text, &end);
+
+        if(config.ratio_count == MICRO_MAX_RATIOS || end == text || *end != '\0' || ratio < 0 || ratio > 1)
+        {
+            cout << "main::Not found expected hit ratio " << text << ", invalid input!" << endl;
+            exit(1);
+        }
+
+        config.ratios[config.ratio_count++] = ratio;
+    }
+
+    if(config.size_count == 0 || config.ratio_count == 0 || config.calls == 0 || config.repeats < 1 || config.ways < 0)
+    {
+        cout << "main::Cache sizes, hit ratios, calls, repeats or ways are out of range, invalid input!" << endl;
+        exit(1);
+    }
+
+    printf("kernel,l2_size,hit_ratio,calls,unit,min,median,mean,stddev\n");
+
+    for(int i=0; i<config.size_count; i++)
+    {
+        Simulator *sim = _createSimulator(&config, config.sizes[i]);
+
+        _benchLookups(sim, &config, sizeTexts[i]);
+        _benchLRU(sim, &config, sizeTexts[i]);
+        _benchBitmap(sim, &config, sizeTexts[i]);
+
+        if(i == 0)
+        {
+            _benchParsers(sim, &config);
+        }
+
+        delete sim;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+Simulator *_createSimulator(const micro_config *config, obj_size size)
+{
+    Simulator *sim = new Simulator();
+    obj_size line = {64, B};
+    obj_size sizeL3 = {size.data * 2, size.unit};
+    obj_time speedL2 = {2, ns}, speedL3 = {7, ns}, replacement = {1, ns}, broadcast = {3, ns}, memory = {20, ns};
+
+    // memory has room for pages which are in no cache
+    unsigned long memoryMB = (size.data << (10 * size.unit)) * 8 >> 20;
+    obj_size memorySize = {memoryMB > 64 ? memoryMB : 64, MB};
+
+    sim->quiet_output = 1;
+    sim->output = NULL;
+    sim->memorySize(memorySize);
+    sim->numOfChips(2);
+    sim->numOfCores(-1, 1);
+    sim->cacheLineSize(line);
+    sim->cacheSize(0, size);
+    sim->cacheSize(1, size);
+    sim->cacheSize(-1, sizeL3);
+    sim->cacheAccessSpeed(0, speedL2);
+    sim->cacheAccessSpeed(1, speedL2);
+    sim->cacheAccessSpeed(-1, speedL3);
+    sim->replacementSpeed(replacement);
+    sim->broadcastSpeed(broadcast);
+    sim->memoryAccessSpeed(memory);
+
+    if(config->ways > 0)
+    {
+        sim->cacheAssociativity(0, config->ways);
+        sim->cacheAssociativity(1, config->ways);
+        sim->cacheAssociativity(-1, config->ways);
+    }
+
+    // the pages 0 to the blocks of L2 fill every way of L2 of chip 0, and L3
+    obj_size word = {8, B};
+    char address[24];
+
+    for(unsigned long i=0; i<sim->kernelBlocksL2(); i++)
+    {
+        snprintf(address, sizeof(address), "%lx", i * line.data);
+        sim->read(0, 0, address, word);
+    }
+
+    return sim;
+}
+
+void _benchLookups(Simulator *sim, const micro_config *config, const char *sizeText)
+{
+    unsigned long cached = sim->kernelBlocksL2();
+    unsigned long uncached = sim->kernelMemoryPages() - sim->kernelBlocksL3();
+    unsigned long *pages = new unsigned long[config->calls];
+    micro_samples samples = {new double[config->repeats], 0};
+    unsigned long state = 1;
+
+    for(int r=0; r<config->ratio_count; r++)
+    {
+        double ratio = config->ratios[r];
+
+        // a hit is a page filled at the start, a miss is a page after all of L3
+        for(unsigned long i=0; i<config->calls; i++)
+        {
+            bool isHit = (_nextRandom(&state) % 1000000) < ratio * 1000000;
+
+            pages[i] = isHit ? _nextRandom(&state) % cached : sim->kernelBlocksL3() + _nextRandom(&state) % uncached;
+        }
+
+        for(int level=2; level<=3; level++)
+        {
+            unsigned long hits = 0;
+
+            for(unsigned long i=0; i<config->calls; i++)
+            {
+                hits += (level == 2 ? sim->kernelCheckL2(pages[i]) : sim->kernelCheckL3(pages[i])) != -1;
+            }
+
+            samples.count = 0;
+
+            for(int k=0; k<config->repeats; k++)
+            {
+                unsigned long sum = 0;
+                unsigned long start = _readTicks();
+
+                if(level == 2)
+                {
+                    for(unsigned long i=0; i<config->calls; i++)
+                    {
+                        sum += sim->kernelCheckL2(pages[i]);
+                    }
+                }
+                else
+                {
+                    for(unsigned long i=0; i<config->calls; i++)
+                    {
+                        sum += sim->kernelCheckL3(pages[i]);
+                    }
+                }
+
+                _addSample(&samples, start, _readTicks(), config->calls);
+                MicroSink += sum;
+            }
+
+            // the ratio is the one measured, a few pages may be out of the cache
+            _printSamples(level == 2 ? "_checkCacheL2" : "_checkCacheL3", sizeText, (double)hits / config->calls, config->calls, &samples);
+        }
+    }
+
+    delete[] pages;
+    delete[] samples.ticks;
+}
+
+void _benchLRU(Simulator *sim, const micro_config *config, const char *sizeText)
+{
+    unsigned long blocks = sim->kernelBlocksL2();
+    int sets = sim->kernelSetsL2();
+    unsigned long calls = config->calls < blocks ? config->calls : blocks; // each block is taken out once in a batch
+    int *indexes = new int[config->calls];
+    micro_samples samples = {new double[config->repeats], 0};
+    unsigned long state = 2;
+
+    for(unsigned long i=0; i<config->calls; i++)
+    {
+        indexes[i] = _nextRandom(&state) % blocks;
+    }
+
+    for(int k=0; k<config->repeats; k++)
+    {
+        unsigned long start = _readTicks();
+
+        for(unsigned long i=0; i<config->calls; i++)
+        {
+            sim->kernelSwapLRU(indexes[i]);
+        }
+
+        _addSample(&samples, start, _readTicks(), config->calls);
+    }
+
+    _printSamples("_swapTLBByLRU", sizeText, MICRO_NO_RATIO, config->calls, &samples);
+    samples.count = 0;
+
+    for(int k=0; k<config->repeats; k++)
+    {
+        unsigned long sum = 0;
+        unsigned long start = _readTicks();
+
+        // one set after another, like the replacements of a miss on each set
+        for(unsigned long i=0; i<calls; i++)
+        {
+            indexes[i] = sim->kernelTakeLRU(i % sets);
+            sum += indexes[i];
+        }
+
+        _addSample(&samples, start, _readTicks(), calls);
+        MicroSink += sum;
+
+        // put them back in the same order, so the LRU order is as before
+        for(unsigned long i=0; i<calls; i++)
+        {
+            sim->kernelPutBackLRU(indexes[i]);
+        }
+    }
+
+    _printSamples("_takeTheFirstOutByLRU", sizeText, MICRO_NO_RATIO, calls, &samples);
+
+    delete[] indexes;
+    delete[] samples.ticks;
+}
+
+void _benchBitmap(Simulator *sim, const micro_config *config, const char *sizeText)
+{
+    unsigned long blocks = sim->kernelBlocksL2();
+    int sets = sim->kernelSetsL2();
+    int ways = sim->kernelWaysL2();
+    unsigned long calls = config->calls < blocks ? config->calls : blocks; // each block is visited at most once in a batch
+    micro_samples samples = {new double[config->repeats], 0};
+
+    for(int r=0; r<config->ratio_count; r++)
+    {
+        double ratio = config->ratios[r];
+        unsigned long found = 0;
+        int visits = calls < (unsigned long)ways ? calls : ways; // the calls which visit each set
+        int taken = ways - (int)(ratio * visits + 0.5);
+
+        samples.count = 0;
+
+        for(int k=0; k<config->repeats; k++)
+        {
+            // a hit is a set with an empty block, only ratio of the visits of each set find one
+            sim->kernelEmptyBitmap(taken);
+
+            unsigned long sum = 0;
+            unsigned long start = _readTicks();
+
+            // each set is visited once for each of its ways, like the misses which fill it
+            for(unsigned long i=0; i<calls; i++)
+            {
+                sum += sim->kernelFindEmptyBlock(i / ways % sets);
+            }
+
+            _addSample(&samples, start, _readTicks(), calls);
+            MicroSink += sum;
+            found = 0;
+
+            for(int s=0; s<sets; s++)
+            {
+                found += ways - sim->kernelEmptyBlocks(s);
+            }
+        }
+
+        // the ratio is the calls which found a block
+        _printSamples("_findAvailableBlockInCacheL2", sizeText, (double)(found - sets * (unsigned long)taken) / calls, calls, &samples);
+    }
+
+    // the bitmap of the filled cache is put back at the end
+    sim->kernelRestoreBitmap();
+
+    delete[] samples.ticks;
+}
+
+void _benchParsers(Simulator *sim, const micro_config *config)
+{
+    const char *texts[] = {"32KB", "20ns", "12", "0x7ffd3a40", "read(1,2,0x7ffd3a40,8B)"};
+    const char *kernels[] = {"_getSize", "_getTime", "_getNumber", "_getAddress", "_parseCommand"};
+    obj_size sizes[] = {{8, B}, {64, B}, {4, KB}};
+    micro_samples samples = {new double[config->repeats], 0};
+
+    // an aligned word, a word across two lines, and a page
+    for(int k=0; k<config->repeats; k++)
+    {
+        unsigned long sum = 0;
+        unsigned long start = _readTicks();
+
+        for(unsigned long i=0; i<config->calls; i++)
+        {
+            sum += sim->kernelNeedBlocks(0x1000 + (i % 3 == 1) * 60, sizes[i % 3]);
+        }
+
+        _addSample(&samples, start, _readTicks(), config->calls);
+        MicroSink += sum;
+    }
+
+    _printSamples("_caculateNeedBlocks", "-", MICRO_NO_RATIO, config->calls, &samples);
+
+    for(int p=0; p<5; p++)
+    {
+        const char *start = texts[p];
+        const char *end = start + strlen(start);
+
+        samples.count = 0;
+
+        for(int k=0; k<config->repeats; k++)
+        {
+            obj_size size;
+            unsigned long errors = 0;
+            unsigned long begin = _readTicks();
+
+            for(unsigned long i=0; i<config->calls; i++)
+            {
+                errors += Simulator::kernelParse(p, start, end, &size) != NULL;
+            }
+
+            _addSample(&samples, begin, _readTicks(), config->calls);
+            MicroSink += errors;
+        }
+
+        _printSamples(kernels[p], "-", MICRO_NO_RATIO, config->calls, &samples);
+    }
+
+    delete[] samples.ticks;
+}
+
+unsigned long _readTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+#endif
+}
+
+unsigned long _nextRandom(unsigned long *state)
+{
+    unsigned long x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    *state = x;
+
+    return x;
+}
+
+void _addSample(micro_samples *samples, unsigned long start, unsigned long end, unsigned long calls)
+{
+    samples->ticks[samples->count++] = (double)(end - start) / calls;
+}
+
+void _printSamples(const char *kernel, const char *sizeText, double ratio, unsigned long calls, micro_samples *samples)
+{
+    double *ticks = samples->ticks;
+    int count = samples->count;
+    double mean = 0, variance = 0;
+
+    sort(ticks, ticks + count);
+
+    for(int i=0; i<count; i++)
+    {
+        mean += ticks[i] / count;
+    }
+
+    for(int i=0; i<count; i++)
+    {
+        variance += (ticks[i] - mean) * (ticks[i] - mean) / (count > 1 ? count - 1 : 1);
+    }
+
+    double median = count % 2 == 1 ? ticks[count / 2] : (ticks[count / 2 - 1] + ticks[count / 2]) / 2;
+
+    printf("%s,%s,", kernel, sizeText);
+
+    if(ratio == MICRO_NO_RATIO)
+    {
+        printf("-,");
+    }
+    else
+    {
+        printf("%.3f,", ratio);
+    }
+
+    printf("%lu,%s,%.2f,%.2f,%.2f,%.2f\n", calls, TICK_UNIT, ticks[0], median, mean, sqrt(variance));
+}
+
+bool _parseMicroSize(const char *text, obj_size *size)
+{
+    // the same size text as in a trace, without its spaces
+    return Simulator::kernelParse(0, text, text + strlen(text), size) == NULL && size->data > 0;
+}